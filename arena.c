@@ -0,0 +1,60 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<stdlib.h>
+#include<string.h>
+
+// memory is handed out from the end of the newest block, and only
+// given back when the whole arena is freed. an allocation that would
+// not fit in a block of the usual size gets a block of its own, which
+// is kept behind the newest so that it can still be filled
+struct arena_block {
+	struct arena_block *next;
+	size_t size, used;
+	char data[];
+};
+
+// zeroed memory, aligned to arena_align
+void *arenaAlloc(arena_t *a, size_t size){
+	struct arena_block *b = a->blocks;
+	size_t start = 0;
+	if(b != NULL){
+		// the start of data need not be aligned itself
+		uintptr_t at = (uintptr_t) (b->data + b->used);
+		start = b->used + (arena_align - at % arena_align) % arena_align;
+	}
+	if(b == NULL || start + size > b->size){
+		size_t space = (size + arena_align > arena_block_size)? size + arena_align : arena_block_size;
+		struct arena_block *fresh = calloc(1, sizeof(struct arena_block) + space);
+		if(fresh == NULL){ return NULL; }
+		fresh->size = space;
+		if(b != NULL && space > arena_block_size){
+			fresh->next = b->next;
+			b->next = fresh;
+		} else {
+			fresh->next = b;
+			a->blocks = fresh;
+		}
+		b = fresh;
+		start = (arena_align - (uintptr_t) b->data % arena_align) % arena_align;
+	}
+	b->used = start + size;
+	return b->data + start;
+}
+
+void *arenaCopy(arena_t *a, const void *p, size_t size){
+	void *copy = arenaAlloc(a, size);
+	memcpy(copy, p, size);
+	return copy;
+}
+
+void arenaFree(arena_t *a){
+	while(a->blocks != NULL){
+		struct arena_block *b = a->blocks;
+		a->blocks = b->next;
+		free(b);
+	}
+}
@@ -0,0 +1,234 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<math.h>
+#include<stdio.h>
+#include<string.h>
+#include<stdlib.h>
+
+// the runs of a batch, and what became of each of them
+typedef struct {
+	sim_t *t;
+	const char *results;
+	int total;
+
+	// the value each variation had in each run
+	double *values;
+	uint8_t *ok;
+	int *steps, *iters;
+	// records of each run, for statistics
+	double **records;
+	size_t *rows;
+} batch_run_t;
+
+// splitmix64, seeded from the run number so that every run gets the same
+// random values no matter which thread it happens to run on
+static uint64_t nextRandom(uint64_t *state){
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static double uniform(uint64_t *state){
+	return (nextRandom(state) >> 11)/9007199254740992.0;
+}
+
+// box-muller, 1 - uniform is never 0
+static double gauss(uint64_t *state){
+	double u1 = 1 - uniform(state), u2 = uniform(state);
+	return sqrt(-2*log(u1))*cos(2*M_PI*u2);
+}
+
+// the runs go through every combination of sweep points, the last sweep
+// changing fastest, with the monte carlo runs done at each combination
+static void applyVariations(sim_t *s, int run, double *values){
+	int point = run/s->runs;
+	uint64_t state = s->seed*0x2545f4914f6cdd1dull + run;
+	nextRandom(&state);
+
+	for(int i = s->variations_count - 1; i >= 0; i--){
+		variation_t *var = s->variations + i;
+		if(var->type != vary_linear && var->type != vary_log){ continue; }
+		int index = point%var->points;
+		point /= var->points;
+		double t = (var->points > 1)? (double) index/(var->points - 1) : 0;
+		double *p = s->c[var->component].parameters + var->parameter;
+		if(var->type == vary_linear){ *p = var->from + t*(var->to - var->from); }
+		else { *p = var->from*pow(var->to/var->from, t); }
+	}
+	for(int i = 0; i < s->variations_count; i++){
+		variation_t *var = s->variations + i;
+		double *p = s->c[var->component].parameters + var->parameter;
+		if(var->type == vary_uniform){ *p *= 1 + var->spread*(2*uniform(&state) - 1); }
+		else if(var->type == vary_gauss){ *p *= 1 + var->spread*gauss(&state); }
+	}
+	for(int i = 0; i < s->variations_count; i++){
+		variation_t *var = s->variations + i;
+		values[i] = s->c[var->component].parameters[var->parameter];
+	}
+}
+
+// results.csv becomes results_12.csv, or results_12.bin for binary runs
+static void runName(sim_t *s, const char *results, int run, char *name){
+	const char *dot = strrchr(results, '.');
+	const char *slash = strrchr(results, '/');
+	if(dot == NULL || (slash != NULL && dot < slash)){ dot = results + strlen(results); }
+	sprintf(name, "%.*s_%i%s", (int) (dot - results), results, run,
+		(s->format == format_binary)? ".bin" : ".csv");
+}
+
+static void runTask(void *ctx, int run){
+	batch_run_t *b = ctx;
+	sim_t s;
+	if(!simCopy(&s, b->t)){ return; }
+	applyVariations(&s, run, b->values + run*b->t->variations_count);
+	s.quiet = 1;
+	// the table model is read only, so the runs share the one in t
+	s.table = b->t->table;
+
+	FILE *f = NULL;
+	if(s.batch == batch_stats){
+		s.format = format_memory;
+	} else {
+		char *name = malloc(strlen(b->results) + 16);
+		runName(b->t, b->results, run, name);
+		f = fopen(name, (s.format == format_binary)? "wb" : "w");
+		if(f == NULL){ fprintf(stderr, "error: could not open file \"%s\"\n", name); }
+		free(name);
+	}
+
+	if(s.format == format_memory || f != NULL){
+		b->ok[run] = simulate(&s, f);
+	}
+	if(f != NULL){ fclose(f); }
+	b->steps[run] = s.stats.steps;
+	b->iters[run] = s.stats.iters_total;
+	if(b->ok[run] && s.batch == batch_stats){
+		b->records[run] = s.records;
+		b->rows[run] = s.records_rows;
+		s.records = NULL;
+	}
+	simFree(&s);
+}
+
+// list the parameters of each run, and the file it was written to
+static void writeIndex(batch_run_t *b, FILE *f){
+	sim_t *t = b->t;
+	fprintf(f, "run");
+	for(int i = 0; i < t->variations_count; i++){
+		fprintf(f, ", %s.%i", t->c_info[t->variations[i].component].name, t->variations[i].parameter + 1);
+	}
+	fprintf(f, ", file\n");
+	char *name = malloc(strlen(b->results) + 16);
+	for(int run = 0; run < b->total; run++){
+		fprintf(f, "%i", run);
+		for(int i = 0; i < t->variations_count; i++){
+			fprintf(f, ", %.*e", t->precision, b->values[run*t->variations_count + i]);
+		}
+		runName(b->t, b->results, run, name);
+		fprintf(f, ", %s\n", b->ok[run]? name : "failed");
+	}
+	free(name);
+}
+
+// the mean, standard deviation, minimum and maximum of every measured value
+// over the runs that succeeded. runs are always combined in the same order,
+// so the result does not depend on the number of threads
+static void writeStats(batch_run_t *b, FILE *f){
+	sim_t *t = b->t;
+	int count = recordSize(t), width = count + 1, n = 0;
+	size_t rows = 0;
+	double *first = NULL;
+	for(int run = 0; run < b->total; run++){
+		if(!b->ok[run]){ continue; }
+		if(n == 0 || b->rows[run] < rows){ rows = b->rows[run]; }
+		if(n == 0){ first = b->records[run]; }
+		n++;
+	}
+
+	fprintf(f, "time(s)");
+	for(int i = 0; i < count; i++){
+		const char *unit, *name = recordLabel(t, i, &unit);
+		fprintf(f, ", %s(%s) mean, %s(%s) std, %s(%s) min, %s(%s) max",
+			name, unit, name, unit, name, unit, name, unit);
+	}
+	fprintf(f, "\n");
+
+	for(size_t row = 0; row < rows; row++){
+		fprintf(f, "%.*e", t->precision, first[row*width]);
+		for(int i = 1; i < width; i++){
+			double sum = 0, min = INFINITY, max = -INFINITY;
+			for(int run = 0; run < b->total; run++){
+				if(!b->ok[run]){ continue; }
+				double x = b->records[run][row*width + i];
+				sum += x;
+				if(x < min){ min = x; }
+				if(x > max){ max = x; }
+			}
+			double mean = sum/n, sumsq = 0;
+			for(int run = 0; run < b->total; run++){
+				if(!b->ok[run]){ continue; }
+				double d = b->records[run][row*width + i] - mean;
+				sumsq += d*d;
+			}
+			double std = (n > 1)? sqrt(sumsq/(n - 1)) : 0;
+			fprintf(f, ", %.*e, %.*e, %.*e, %.*e", t->precision, mean,
+				t->precision, std, t->precision, min, t->precision, max);
+		}
+		fprintf(f, "\n");
+	}
+}
+
+// simulate every run of the batch described by t, on a pool of threads.
+// f is the results file, which gets the statistics, or the list of runs
+int simulateBatch(sim_t *t, FILE *f, const char *results){
+	batch_run_t b = {.t = t, .results = results, .total = t->runs};
+	for(int i = 0; i < t->variations_count; i++){
+		if(t->variations[i].type == vary_linear || t->variations[i].type == vary_log){
+			b.total *= t->variations[i].points;
+		}
+	}
+	b.values = calloc((size_t) b.total*t->variations_count + 1, sizeof(double));
+	b.ok = calloc(b.total, sizeof(uint8_t));
+	b.steps = calloc(b.total, sizeof(int));
+	b.iters = calloc(b.total, sizeof(int));
+	b.records = calloc(b.total, sizeof(double*));
+	b.rows = calloc(b.total, sizeof(size_t));
+
+	if(t->table_points > 0 && t->table == NULL){ t->table = satExpTable(&t->arena, t->table_points); }
+	int threads = (t->threads < b.total)? t->threads : b.total;
+	pool_t *p = poolCreate(threads);
+	poolRun(p, b.total, runTask, &b);
+	poolDestroy(p);
+
+	int failed = 0;
+	long steps = 0, iters = 0;
+	for(int run = 0; run < b.total; run++){
+		if(!b.ok[run]){
+			fprintf(stderr, "error: run %i failed\n", run);
+			failed++;
+		}
+		steps += b.steps[run];
+		iters += b.iters[run];
+	}
+	if(t->batch == batch_stats){ writeStats(&b, f); }
+	else { writeIndex(&b, f); }
+
+	fprintf(stderr, "runs = %i, failed = %i, threads = %i\n", b.total, failed, threads);
+	fprintf(stderr, "cycles = %li, total iterations = %li\n", steps, iters);
+	if(t->table_points > 0){
+		double value_error, deriv_error;
+		satExpTableError(t->table, &value_error, &deriv_error);
+		fprintf(stderr, "table model: %i points, max error %.2g (current), %.2g (slope)\n",
+			t->table_points, value_error, deriv_error);
+	}
+
+	for(int run = 0; run < b.total; run++){ free(b.records[run]); }
+	free(b.values); free(b.ok); free(b.steps); free(b.iters);
+	free(b.records); free(b.rows);
+	return failed == 0 && fflush(f) == 0 && !ferror(f);
+}
@@ -0,0 +1,458 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+// the sparse jacobian split in to diagonal blocks of nodes that only connect
+// to each other and to a border of nodes between them (bordered block
+// diagonal form). the blocks are factorized independently, on the threads of
+// the simulation, and only the schur complement of the border is factorized
+// after them:
+//   S = A_ss - sum of C_k A_k^-1 B_k
+// where B_k are the block's rows of the border columns and C_k the border
+// rows of the block's columns. the split is made once, when the matrix is set up
+
+// one diagonal block, with local node numbers
+typedef struct {
+	sparse_t a;
+	int n, *nodes;
+	// the jacobian element of each element of a
+	int *a_map;
+	// the border nodes the block is joined to (r of them), and the elements of
+	// B_k and C_k, in local rows and columns where r indexes adjacent. b is
+	// sorted by column, starting at b_colptr
+	int r, *adjacent;
+	int b_count, *b_colptr, *b_row, *b_map;
+	int c_count, *c_row, *c_col, *c_map;
+	double *b_values, *c_values;
+	// the position of the first column of C_k in the pivot order
+	int c_first;
+	// this block's part of S, r by r, and the element of S each goes to
+	double *schur;
+	int *schur_map;
+	double *x, *y;
+	uint8_t failed, repivoted;
+} bbd_block_t;
+
+struct bbd {
+	int count, border;
+	bbd_block_t *blocks;
+	int *border_nodes;
+	// S, and the jacobian elements between border nodes that it starts from
+	sparse_t schur;
+	int s_count, *s_from, *s_to;
+	double *e_border;
+	// what the tasks are working on
+	sim_t *s;
+	const double *jac;
+	double *e;
+};
+
+// breadth first search of the component containing start, numbering the
+// levels from base. nodes are appended to order from count. returns the new count
+static int search(const sparse_t *m, int start, int base, int *level, int *order, int count){
+	int head = count;
+	level[start] = base;
+	order[count++] = start;
+	while(head < count){
+		int j = order[head++];
+		for(int p = m->colptr[j]; p < m->colptr[j + 1]; p++){
+			int i = m->rowind[p];
+			if(level[i] < 0){
+				level[i] = level[j] + 1;
+				order[count++] = i;
+			}
+		}
+	}
+	return count;
+}
+
+// split the variable nodes in to blocks along the levels of a breadth first
+// search from a far away node, where one whole level between two blocks
+// becomes border (block -1), since the levels either side of it can not be
+// joined. a new connected component can start a block without any border.
+// returns the number of blocks
+static int partition(const sparse_t *m, int parts, int *block){
+	int n = m->n, count = 0, levels = 0;
+	int *level = malloc(sizeof(int)*(n + 1)), *order = malloc(sizeof(int)*(n + 1));
+	int *level_size = calloc(n + 1, sizeof(int)), *component_start = calloc(n + 1, sizeof(int));
+	for(int i = 0; i < n; i++){ level[i] = -1; }
+	for(int u = 0; u < n; u++){
+		if(level[u] >= 0){ continue; }
+		// the last node found is far from u, so search again from there
+		int end = search(m, u, 0, level, order, count);
+		int far = order[end - 1];
+		for(int k = count; k < end; k++){ level[order[k]] = -1; }
+		end = search(m, far, levels, level, order, count);
+		component_start[levels] = 1;
+		for(int k = count; k < end; k++){
+			level_size[level[order[k]]]++;
+			if(level[order[k]] + 1 > levels){ levels = level[order[k]] + 1; }
+		}
+		count = end;
+	}
+
+	// cut after the level that fills each block, unless there is nothing left
+	int *level_block = malloc(sizeof(int)*(levels + 1)), b = 0, filled = 0;
+	for(int l = 0; l < levels; l++){
+		level_block[l] = b;
+		filled += level_size[l];
+		if(b + 1 < parts && filled >= (long) n*(b + 1)/parts){
+			if(l + 1 < levels && component_start[l + 1]){ b++; }
+			else if(l + 2 < levels){
+				level_block[++l] = -1;
+				filled += level_size[l];
+				b++;
+			}
+		}
+	}
+	for(int i = 0; i < n; i++){ block[i] = level_block[level[i]]; }
+	free(level); free(order); free(level_size); free(component_start); free(level_block);
+	return b + 1;
+}
+
+int bbdSetup(sim_t *s){
+	sparse_t *m = &s->sparse;
+	int n = m->n;
+	int *block = malloc(sizeof(int)*(n + 1));
+	int count = partition(m, s->partitions, block), border = 0;
+	for(int i = 0; i < n; i++){ border += (block[i] < 0); }
+	if(count < 2 || border > n/2){
+		fprintf(stderr, "note: the circuit can not be split in to %i partitions, it is solved whole\n", s->partitions);
+		free(block);
+		return 0;
+	}
+
+	struct bbd *d = calloc(1, sizeof(struct bbd));
+	d->count = count;
+	d->border = border;
+	d->blocks = calloc(count, sizeof(bbd_block_t));
+	d->border_nodes = malloc(sizeof(int)*(border + 1));
+	d->e_border = malloc(sizeof(double)*(border + 1));
+	// local number of each node, in its block or the border
+	int *local = malloc(sizeof(int)*(n + 1));
+	border = 0;
+	for(int i = 0; i < n; i++){
+		if(block[i] < 0){ d->border_nodes[border] = i; local[i] = border++; }
+		else { local[i] = d->blocks[block[i]].n++; }
+	}
+	for(int k = 0; k < count; k++){
+		d->blocks[k].nodes = malloc(sizeof(int)*(d->blocks[k].n + 1));
+		d->blocks[k].n = 0;
+	}
+	for(int i = 0; i < n; i++){
+		if(block[i] >= 0){ d->blocks[block[i]].nodes[d->blocks[block[i]].n++] = i; }
+	}
+
+	// count the elements of each part, and find the border nodes next to each block
+	int *position = malloc(sizeof(int)*(border + 1));
+	for(int i = 0; i < border; i++){ position[i] = -1; }
+	for(int j = 0; j < n; j++){
+		for(int p = m->colptr[j]; p < m->colptr[j + 1]; p++){
+			int i = m->rowind[p];
+			if(block[j] >= 0 && block[i] < 0){ d->blocks[block[j]].c_count++; }
+			else if(block[j] < 0 && block[i] >= 0){ d->blocks[block[i]].b_count++; }
+			else if(block[j] < 0){ d->s_count++; }
+		}
+	}
+	for(int k = 0; k < count; k++){
+		bbd_block_t *b = d->blocks + k;
+		b->adjacent = malloc(sizeof(int)*(b->b_count + b->c_count + 1));
+		b->b_colptr = calloc(b->b_count + b->c_count + 2, sizeof(int));
+		b->b_row = malloc(sizeof(int)*(b->b_count + 1));
+		b->b_map = malloc(sizeof(int)*(b->b_count + 1));
+		b->b_values = malloc(sizeof(double)*(b->b_count + 1));
+		b->c_row = malloc(sizeof(int)*(b->c_count + 1));
+		b->c_col = malloc(sizeof(int)*(b->c_count + 1));
+		b->c_map = malloc(sizeof(int)*(b->c_count + 1));
+		b->c_values = malloc(sizeof(double)*(b->c_count + 1));
+		b->x = malloc(sizeof(double)*(b->n + 1));
+		b->y = malloc(sizeof(double)*(b->n + 1));
+
+		// the pattern of A_k, and of C_k, from the block's columns
+		int a_count = 0, *rows = NULL, *cols = NULL, *from = NULL;
+		for(int pass = 0; pass < 2; pass++){
+			a_count = b->c_count = 0;
+			for(int lj = 0; lj < b->n; lj++){
+				int j = b->nodes[lj];
+				for(int p = m->colptr[j]; p < m->colptr[j + 1]; p++){
+					int i = m->rowind[p];
+					if(block[i] == k){
+						if(pass){ rows[a_count] = local[i]; cols[a_count] = lj; from[a_count] = p; }
+						a_count++;
+					} else if(pass){
+						if(position[local[i]] < 0){
+							position[local[i]] = b->r;
+							b->adjacent[b->r++] = local[i];
+						}
+						b->c_row[b->c_count] = position[local[i]];
+						b->c_col[b->c_count] = lj;
+						b->c_map[b->c_count++] = p;
+					} else {
+						b->c_count++;
+					}
+				}
+			}
+			if(!pass){
+				rows = malloc(sizeof(int)*(a_count + 1));
+				cols = malloc(sizeof(int)*(a_count + 1));
+				from = malloc(sizeof(int)*(a_count + 1));
+			}
+		}
+		sparseBuild(&b->a, b->n, a_count, rows, cols);
+		b->a_map = malloc(sizeof(int)*(b->a.nnz + 1));
+		for(int p = 0; p < b->a.nnz; p++){ b->a_map[p] = -1; }
+		for(int q = 0; q < a_count; q++){ b->a_map[sparseIndex(&b->a, rows[q], cols[q])] = from[q]; }
+		free(rows); free(cols); free(from);
+
+		// B_k, from the border columns, sorted by column
+		for(int lj = 0; lj < border; lj++){
+			int j = d->border_nodes[lj];
+			for(int p = m->colptr[j]; p < m->colptr[j + 1]; p++){
+				if(block[m->rowind[p]] != k){ continue; }
+				if(position[lj] < 0){
+					position[lj] = b->r;
+					b->adjacent[b->r++] = lj;
+				}
+				b->b_colptr[position[lj] + 1]++;
+			}
+		}
+		for(int c = 0; c < b->r; c++){ b->b_colptr[c + 1] += b->b_colptr[c]; }
+		int *fill = malloc(sizeof(int)*(b->r + 1));
+		memcpy(fill, b->b_colptr, sizeof(int)*(b->r + 1));
+		for(int lj = 0; lj < border; lj++){
+			int j = d->border_nodes[lj];
+			for(int p = m->colptr[j]; p < m->colptr[j + 1]; p++){
+				int i = m->rowind[p];
+				if(block[i] != k){ continue; }
+				int q = fill[position[lj]]++;
+				b->b_row[q] = local[i];
+				b->b_map[q] = p;
+			}
+		}
+		free(fill);
+		for(int c = 0; c < b->r; c++){ position[b->adjacent[c]] = -1; }
+
+		// C_k A_k^-1 B_k only needs the unknowns of A_k^-1 B_k from the first
+		// one C_k reads on, so the substitutions can stop there. ordering the
+		// nodes next to the border last to move that point later was tried,
+		// but the fill it causes cost more than the substitutions it saved
+		uint8_t *last = calloc(b->n + 1, sizeof(uint8_t));
+		for(int q = 0; q < b->c_count; q++){ last[b->c_col[q]] = 1; }
+		b->c_first = b->n;
+		for(int k = b->n - 1; k >= 0; k--){
+			if(last[b->a.q[k]]){ b->c_first = k; }
+		}
+		free(last);
+		b->schur = malloc(sizeof(double)*(b->r*b->r + 1));
+		b->schur_map = malloc(sizeof(int)*(b->r*b->r + 1));
+	}
+
+	// S has the pattern of A_ss, and every pair of border nodes next to a block
+	int pairs = d->s_count;
+	for(int k = 0; k < count; k++){ pairs += d->blocks[k].r*d->blocks[k].r; }
+	int *rows = malloc(sizeof(int)*(pairs + 1)), *cols = malloc(sizeof(int)*(pairs + 1));
+	d->s_from = malloc(sizeof(int)*(d->s_count + 1));
+	d->s_to = malloc(sizeof(int)*(d->s_count + 1));
+	pairs = 0;
+	for(int lj = 0; lj < border; lj++){
+		int j = d->border_nodes[lj];
+		for(int p = m->colptr[j]; p < m->colptr[j + 1]; p++){
+			if(block[m->rowind[p]] >= 0){ continue; }
+			d->s_from[pairs] = p;
+			rows[pairs] = local[m->rowind[p]];
+			cols[pairs++] = lj;
+		}
+	}
+	for(int k = 0; k < count; k++){
+		bbd_block_t *b = d->blocks + k;
+		for(int x = 0; x < b->r; x++){
+			for(int y = 0; y < b->r; y++){
+				rows[pairs] = b->adjacent[x];
+				cols[pairs++] = b->adjacent[y];
+			}
+		}
+	}
+	sparseBuild(&d->schur, border, pairs, rows, cols);
+	for(int q = 0; q < d->s_count; q++){ d->s_to[q] = sparseIndex(&d->schur, rows[q], cols[q]); }
+	for(int k = 0; k < count; k++){
+		bbd_block_t *b = d->blocks + k;
+		for(int x = 0; x < b->r; x++){
+			for(int y = 0; y < b->r; y++){
+				b->schur_map[x*b->r + y] = sparseIndex(&d->schur, b->adjacent[x], b->adjacent[y]);
+			}
+		}
+	}
+	free(rows); free(cols); free(position); free(local); free(block);
+	d->s = s;
+	s->bbd = d;
+	return 1;
+}
+
+void bbdFree(sim_t *s){
+	struct bbd *d = s->bbd;
+	for(int k = 0; k < d->count; k++){
+		bbd_block_t *b = d->blocks + k;
+		sparseRelease(&b->a);
+		free(b->nodes); free(b->a_map); free(b->adjacent);
+		free(b->b_colptr); free(b->b_row); free(b->b_map); free(b->b_values);
+		free(b->c_row); free(b->c_col); free(b->c_map); free(b->c_values);
+		free(b->schur); free(b->schur_map); free(b->x); free(b->y);
+	}
+	sparseRelease(&d->schur);
+	free(d->blocks); free(d->border_nodes); free(d->e_border);
+	free(d->s_from); free(d->s_to);
+	free(d);
+	s->bbd = NULL;
+}
+
+// where the substitutions for a column of B_k have to start: at its first
+// row in the pivot order, or the first column of C_k if that is earlier
+static int columnFirst(const bbd_block_t *b, int col){
+	int first = b->c_first;
+	for(int q = b->b_colptr[col]; q < b->b_colptr[col + 1]; q++){
+		int k = b->a.pinv[b->b_row[q]];
+		if(k < first){ first = k; }
+	}
+	return first;
+}
+
+// factorize A_k, then work out C_k A_k^-1 B_k a column of B_k at a time
+static void factorTask(void *ctx, int index){
+	struct bbd *d = ctx;
+	bbd_block_t *b = d->blocks + index;
+	sim_t *s = d->s;
+	for(int p = 0; p < b->a.nnz; p++){ b->a.values[p] = (b->a_map[p] >= 0)? d->jac[b->a_map[p]] : 0; }
+	for(int q = 0; q < b->b_count; q++){ b->b_values[q] = d->jac[b->b_map[q]]; }
+	for(int q = 0; q < b->c_count; q++){ b->c_values[q] = d->jac[b->c_map[q]]; }
+	int r = -1;
+	b->repivoted = 0;
+	if(s->reuse_pivots && b->a.factored){
+		r = sparseRefactor(&b->a, s->pivot_tol);
+		b->repivoted = (r < 0);
+	}
+	if(r < 0){ r = sparseFactor(&b->a); }
+	b->failed = !r;
+	if(!r){ return; }
+
+	memset(b->schur, 0, sizeof(double)*b->r*b->r);
+	for(int col = 0; col < b->r; col++){
+		if(b->b_colptr[col] == b->b_colptr[col + 1]){ continue; }
+		memset(b->x, 0, sizeof(double)*b->n);
+		for(int q = b->b_colptr[col]; q < b->b_colptr[col + 1]; q++){ b->x[b->b_row[q]] = b->b_values[q]; }
+		sparseSolveFrom(&b->a, b->x, columnFirst(b, col));
+		for(int q = 0; q < b->c_count; q++){
+			b->schur[b->c_row[q]*b->r + col] += b->c_values[q]*b->x[b->c_col[q]];
+		}
+	}
+}
+
+static void runBlocks(struct bbd *d, void (*task)(void *ctx, int index)){
+	if(d->s->eval_pool != NULL){ poolRun(d->s->eval_pool, d->count, task, d); }
+	else {
+		for(int k = 0; k < d->count; k++){ task(d, k); }
+	}
+}
+
+// the blocks are summed in to S in order, so the result does
+// not depend on which thread factorized which block
+int bbdFactor(sim_t *s, const double *jac){
+	struct bbd *d = s->bbd;
+	d->jac = jac;
+	s->sparse.factored = 0;
+	runBlocks(d, factorTask);
+
+	sparse_t *S = &d->schur;
+	memset(S->values, 0, sizeof(double)*S->nnz);
+	for(int q = 0; q < d->s_count; q++){ S->values[d->s_to[q]] += jac[d->s_from[q]]; }
+	for(int k = 0; k < d->count; k++){
+		bbd_block_t *b = d->blocks + k;
+		if(b->failed){ return 0; }
+		if(b->repivoted){ s->stats.repivots++; }
+		for(int x = 0; x < b->r*b->r; x++){ S->values[b->schur_map[x]] -= b->schur[x]; }
+	}
+	int r = -1;
+	if(s->reuse_pivots && S->factored){
+		r = sparseRefactor(S, s->pivot_tol);
+		if(r < 0){ s->stats.repivots++; }
+	}
+	if(r < 0){ r = sparseFactor(S); }
+	s->sparse.factored = r;
+	return r;
+}
+
+// y_k = A_k^-1 e_k
+static void forwardTask(void *ctx, int index){
+	struct bbd *d = ctx;
+	bbd_block_t *b = d->blocks + index;
+	for(int i = 0; i < b->n; i++){ b->y[i] = d->e[b->nodes[i]]; }
+	sparseSolve(&b->a, b->y);
+}
+
+// x_k = A_k^-1 (e_k - B_k x_s) = y_k - A_k^-1 B_k x_s, where B_k x_s is
+// only non-zero next to the border, so most of the substitution is skipped.
+// a block that B_k does not join to the border is already solved
+static void backTask(void *ctx, int index){
+	struct bbd *d = ctx;
+	bbd_block_t *b = d->blocks + index;
+	if(b->b_count == 0){
+		for(int i = 0; i < b->n; i++){ d->e[b->nodes[i]] = b->y[i]; }
+		return;
+	}
+	memset(b->x, 0, sizeof(double)*b->n);
+	for(int col = 0; col < b->r; col++){
+		double x_s = d->e_border[b->adjacent[col]];
+		for(int q = b->b_colptr[col]; q < b->b_colptr[col + 1]; q++){ b->x[b->b_row[q]] += b->b_values[q]*x_s; }
+	}
+	sparseSolve(&b->a, b->x);
+	for(int i = 0; i < b->n; i++){ d->e[b->nodes[i]] = b->y[i] - b->x[i]; }
+}
+
+// solve jac x = e with the factors from bbdFactor, storing x in e
+void bbdSolve(sim_t *s, double *e){
+	struct bbd *d = s->bbd;
+	d->e = e;
+	runBlocks(d, forwardTask);
+	for(int i = 0; i < d->border; i++){ d->e_border[i] = e[d->border_nodes[i]]; }
+	for(int k = 0; k < d->count; k++){
+		bbd_block_t *b = d->blocks + k;
+		for(int q = 0; q < b->c_count; q++){
+			d->e_border[b->adjacent[b->c_row[q]]] -= b->c_values[q]*b->y[b->c_col[q]];
+		}
+	}
+	sparseSolve(&d->schur, d->e_border);
+	runBlocks(d, backTask);
+	for(int i = 0; i < d->border; i++){ e[d->border_nodes[i]] = d->e_border[i]; }
+}
+
+// the work of a factorization and of a solve, and the size of the factors.
+// span is the work of a factorization on the longest thread, with a thread
+// for each block: the biggest block, then the border
+void bbdWork(sim_t *s, double *factor, double *solve, double *span, int *lu_nnz){
+	struct bbd *d = s->bbd;
+	double f, x, biggest = 0;
+	sparseFlops(&d->schur, factor, solve);
+	*span = *factor;
+	*lu_nnz = d->schur.l_colptr[d->border] + d->schur.u_colptr[d->border] - d->border;
+	for(int k = 0; k < d->count; k++){
+		bbd_block_t *b = d->blocks + k;
+		sparseFlops(&b->a, &f, &x);
+		// each column of B_k is only substituted from where it starts
+		const int *l_colptr = b->a.l_colptr, *u_colptr = b->a.u_colptr;
+		for(int col = 0; col < b->r; col++){
+			if(b->b_colptr[col] == b->b_colptr[col + 1]){ continue; }
+			int first = columnFirst(b, col), tail = b->n - first;
+			f += 2.0*(l_colptr[b->n] - l_colptr[first] - tail) + 2.0*(u_colptr[b->n] - u_colptr[first] - tail) + tail + 2.0*b->c_count;
+		}
+		*factor += f;
+		if(f > biggest){ biggest = f; }
+		*solve += ((b->b_count > 0)? 2 : 1)*x + 2.0*(b->b_count + b->c_count);
+		*lu_nnz += b->a.l_colptr[b->n] + b->a.u_colptr[b->n] - b->n;
+	}
+	*span += biggest;
+}
@@ -0,0 +1,259 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<unistd.h>
+
+// a checkpoint is everything that changes as a run goes on: the node
+// voltages, the parameter blocks (which hold the state of the capacitors and
+// inductors), the predictor history, the limiting voltages, the counters and
+// how much output has been written. it is laid out as this header, then
+// those arrays as doubles in that order, then the rows of an unfinished
+// column block. the settings that change its size are kept to check that
+// it belongs to the circuit it is resumed with
+
+#define checkpoint_magic "CSIMCKPT"
+#define checkpoint_version 3
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	int32_t n_count, c_count, params_count, rec_count;
+	int32_t format, single, block_rows, precision;
+	int32_t adaptive, limiting, predictor;
+	double timestep, endtime;
+	// the position of the run, and of its output
+	double time, sample, step;
+	int32_t history_count, block_fill;
+	// the squared error the predictor compares the next step with
+	double e_start;
+	uint64_t rows;
+	int64_t output_length;
+	stats_t stats;
+} checkpoint_header_t;
+
+// the state is copied in to data, which a thread of its own writes to a
+// temporary file and renames over the last checkpoint, so that there is
+// always a whole checkpoint to go back to
+struct checkpoint {
+	pthread_t thread;
+	uint8_t writing, failed;
+	double next;
+	char *data;
+	size_t len, space;
+	char *temp;
+	const char *path;
+	// the checkpoint only replaces the last one once the output
+	// it refers to is written
+	output_t *o;
+	long output_length;
+};
+
+static void append(struct checkpoint *k, const void *p, size_t len){
+	if(k->len + len > k->space){
+		k->space = 2*(k->len + len);
+		k->data = realloc(k->data, k->space);
+	}
+	memcpy(k->data + k->len, p, len);
+	k->len += len;
+}
+
+static void *writeTask(void *arg){
+	struct checkpoint *k = arg;
+	FILE *f = fopen(k->temp, "wb");
+	int ok = f != NULL && fwrite(k->data, 1, k->len, f) == k->len && fflush(f) == 0;
+	// on disk before it replaces the last one
+	ok = ok && fsync(fileno(f)) == 0;
+	if(f != NULL){ ok = (fclose(f) == 0) && ok; }
+	ok = ok && outputWait(k->o, k->output_length);
+	ok = ok && rename(k->temp, k->path) == 0;
+	if(!ok){ k->failed = 1; }
+	return NULL;
+}
+
+static void waitWrite(struct checkpoint *k){
+	if(k->writing){ pthread_join(k->thread, NULL); }
+	k->writing = 0;
+}
+
+static void stop(sim_t *s){
+	struct checkpoint *k = s->checkpoint;
+	free(k->data); free(k->temp); free(k);
+	s->checkpoint = NULL;
+}
+
+// the size of the settings that a checkpoint has to agree with
+static void describe(sim_t *s, checkpoint_header_t *h, int rec_count){
+	memset(h, 0, sizeof(checkpoint_header_t));
+	memcpy(h->magic, checkpoint_magic, sizeof(h->magic));
+	h->version = checkpoint_version;
+	h->n_count = s->n_count;
+	h->c_count = s->c_count;
+	h->params_count = s->params_count;
+	h->rec_count = rec_count;
+	h->format = s->format;
+	h->single = s->single;
+	h->block_rows = s->block_rows;
+	h->precision = s->precision;
+	h->adaptive = s->adaptive;
+	h->limiting = s->limiting;
+	h->predictor = s->predictor;
+	h->timestep = s->timestep;
+	h->endtime = s->endtime;
+}
+
+void checkpointStart(sim_t *s){
+	if(s->checkpoint_interval <= 0){ return; }
+	struct checkpoint *k = calloc(1, sizeof(struct checkpoint));
+	k->path = s->checkpoint_file;
+	k->temp = malloc(strlen(k->path) + 5);
+	strcpy(k->temp, k->path);
+	strcat(k->temp, ".tmp");
+	k->next = profileClock() + s->checkpoint_interval;
+	s->checkpoint = k;
+}
+
+// reading the clock is cheap next to a time step
+int checkpointDue(sim_t *s){
+	return s->checkpoint != NULL && profileClock() >= s->checkpoint->next;
+}
+
+// the output up to the last row is handed to its writer first, so that the
+// checkpoint can say how long it will be. the simulation does not wait for
+// it to be written, the thread that writes the checkpoint does
+void checkpointSave(sim_t *s, output_t *o, const run_t *run){
+	struct checkpoint *k = s->checkpoint;
+	double t = profileStart(s);
+	// the last one has had the whole interval to be written
+	waitWrite(k);
+	long length = outputQueued(o);
+	if(length < 0 || k->failed){
+		fprintf(stderr, "error: could not write checkpoint \"%s\", no more will be written\n", k->path);
+		stop(s);
+		return;
+	}
+
+	checkpoint_header_t h;
+	describe(s, &h, run->rec_count);
+	h.time = run->time;
+	h.sample = run->sample;
+	h.step = run->step;
+	h.history_count = s->history_count;
+	h.e_start = s->e_start;
+	h.block_fill = o->block_fill;
+	h.rows = o->rows;
+	h.output_length = length;
+	h.stats = s->stats;
+	k->len = 0;
+	append(k, &h, sizeof(h));
+	append(k, run->v, sizeof(double)*s->n_count);
+	append(k, s->params, sizeof(double)*max_params*s->params_count);
+	append(k, s->history_time, sizeof(double)*s->history_count);
+	append(k, s->history, sizeof(double)*s->var_n_count*s->history_count);
+	if(s->limiting){ append(k, s->v_last, sizeof(double)*max_terms*s->c_count); }
+	append(k, run->rec_last, sizeof(double)*run->rec_count);
+	if(o->block_rows > 0){ append(k, o->block, sizeof(double)*o->block_rows*(o->count + 1)); }
+
+	k->o = o;
+	k->output_length = length;
+	// without a thread, it is written here instead
+	k->writing = pthread_create(&k->thread, NULL, writeTask, k) == 0;
+	if(!k->writing){ writeTask(k); }
+	k->next = profileClock() + s->checkpoint_interval;
+	profileLap(s, phase_output, t);
+}
+
+static int readArray(FILE *f, void *p, size_t len){
+	return len == 0 || fread(p, 1, len, f) == len;
+}
+
+// restore the state saved in s->checkpoint_file, after the simulation has
+// been prepared and the output opened, and cut the output back to where it
+// was when the checkpoint was written
+int checkpointLoad(sim_t *s, output_t *o, run_t *run){
+	const char *path = s->checkpoint_file;
+	FILE *f = fopen(path, "rb");
+	if(f == NULL){
+		fprintf(stderr, "error: could not open checkpoint \"%s\"\n", path);
+		return 0;
+	}
+	checkpoint_header_t h, expected;
+	describe(s, &expected, run->rec_count);
+	if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, expected.magic, sizeof(h.magic)) != 0 ||
+		h.version != expected.version){
+		fprintf(stderr, "error: \"%s\" is not a circuitsim checkpoint\n", path);
+		fclose(f);
+		return 0;
+	}
+	if(h.n_count != expected.n_count || h.c_count != expected.c_count ||
+		h.params_count != expected.params_count || h.rec_count != expected.rec_count ||
+		h.format != expected.format || h.single != expected.single ||
+		h.block_rows != expected.block_rows || h.precision != expected.precision ||
+		h.adaptive != expected.adaptive || h.limiting != expected.limiting ||
+		h.predictor != expected.predictor || h.timestep != expected.timestep ||
+		h.endtime != expected.endtime){
+		fprintf(stderr, "error: checkpoint \"%s\" does not match the circuit and output options\n", path);
+		fclose(f);
+		return 0;
+	}
+
+	int ok = readArray(f, run->v, sizeof(double)*s->n_count) &&
+		readArray(f, s->params, sizeof(double)*max_params*s->params_count) &&
+		h.history_count >= 0 && h.history_count <= s->predictor + 1 &&
+		readArray(f, s->history_time, sizeof(double)*h.history_count) &&
+		readArray(f, s->history, sizeof(double)*s->var_n_count*h.history_count) &&
+		(!s->limiting || readArray(f, s->v_last, sizeof(double)*max_terms*s->c_count)) &&
+		readArray(f, run->rec_last, sizeof(double)*run->rec_count) &&
+		(o->block_rows == 0 || readArray(f, o->block, sizeof(double)*o->block_rows*(o->count + 1)));
+	fclose(f);
+	if(!ok){
+		fprintf(stderr, "error: checkpoint \"%s\" is truncated\n", path);
+		return 0;
+	}
+
+	// the output may have been written past the checkpoint, but not short of it
+	if(fseek(o->f, 0, SEEK_END) != 0 || ftell(o->f) < h.output_length){
+		fprintf(stderr, "error: the output is shorter than checkpoint \"%s\" expects\n", path);
+		return 0;
+	}
+	if(ftruncate(fileno(o->f), h.output_length) != 0 || fseek(o->f, h.output_length, SEEK_SET) != 0){
+		fprintf(stderr, "error: could not cut the output back to checkpoint \"%s\"\n", path);
+		return 0;
+	}
+	run->time = h.time;
+	run->sample = h.sample;
+	run->step = h.step;
+	run->started = 1;
+	run->accepted = s->adaptive? h.time : h.time - s->timestep;
+	s->history_count = h.history_count;
+	s->e_start = h.e_start;
+	s->stats = h.stats;
+	o->rows = h.rows;
+	o->block_fill = h.block_fill;
+	o->base = h.output_length;
+	if(!s->quiet){ fprintf(stderr, "resuming from \"%s\" at time %.6e\n", path, h.time); }
+	return 1;
+}
+
+// wait for the last checkpoint to be written, which has to be
+// done before the output it waits on is closed
+void checkpointWait(sim_t *s){
+	if(s->checkpoint != NULL){ waitWrite(s->checkpoint); }
+}
+
+// once a run has finished its checkpoint is no use, so it is removed,
+// as is the one it was resumed from, even if it wrote none of its own
+void checkpointFinish(sim_t *s, int ok){
+	struct checkpoint *k = s->checkpoint;
+	if(k != NULL){ waitWrite(k); }
+	if(ok && (k != NULL || s->resume)){ remove(s->checkpoint_file); }
+	if(k == NULL){ return; }
+	if(!ok && k->failed){ fprintf(stderr, "error: could not write checkpoint \"%s\"\n", k->path); }
+	stop(s);
+}
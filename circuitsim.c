@@ -1,48 +1,149 @@
-/*
- * Author: Joslyn Renfrey
- * Date: 13/01/2023
- */
-
-#include"circuitsim.h"
-#include<string.h>
-#include<stdio.h>
-#include<stdlib.h>
-
-int main(int argc, char *argv[]){
-	
-	if(argc < 2){ return 0; }
-	
-	char *spec = argv[1], *results = NULL;
-	if(argc == 2){
-		results = malloc(strlen(spec) + 20);
-		strcpy(results, spec);
-		strcpy(results + strlen(spec), "_results.csv");
-	} else {
-		results = argv[2];
-	}
-	
-	FILE *spec_f = fopen(spec, "r");
-	FILE *results_f = fopen(results, "w");
-	
-	if(spec_f == NULL){
-		fprintf(stderr, "error: could not open file \"%s\"\r\n", spec);
-		return -1;
-	}
-	if(results_f == NULL){
-		fprintf(stderr, "error: could not open file \"%s\"\r\n", results);
-		return -1;
-	}
-	
-	sim_t s;
-	
-	if(!parseFile(spec_f, &s)){
-		return -1;
-	}
-	//printf("file parsed\n");
-	fclose(spec_f);
-	if(!simulate(&s, results_f)){
-		return -1;
-	}
-	fclose(results_f);
-	return 0;
-}
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<string.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+int main(int argc, char *argv[]){
+	
+	if(argc < 2){ return 0; }
+	
+	// options can go anywhere, the first other argument is
+	// the circuit, and the second is the results file
+	char *spec = NULL, *results = NULL, *report = NULL;
+	format_t format = format_csv;
+	uint8_t single = 0;
+	int block_rows = 0, precision = default_precision, threads = 0, op = 0, resume = 0;
+	double checkpoint = 0;
+	for(int i = 1; i < argc; i++){
+		// binary output, optionally in single precision, or in column blocks
+		if(strcmp(argv[i], "--binary") == 0){ format = format_binary; }
+		else if(strcmp(argv[i], "--float") == 0){ format = format_binary; single = 1; }
+		else if(strcmp(argv[i], "--block") == 0 && i + 1 < argc){
+			format = format_binary;
+			block_rows = atoi(argv[++i]);
+			if(block_rows <= 0){
+				fprintf(stderr, "error: invalid block size \"%s\"\r\n", argv[i]);
+				return -1;
+			}
+		}
+		// significant figures after the point in csv output
+		else if(strcmp(argv[i], "--precision") == 0 && i + 1 < argc){
+			precision = atoi(argv[++i]);
+			if(precision < 0 || precision > 16){
+				fprintf(stderr, "error: invalid precision \"%s\"\r\n", argv[i]);
+				return -1;
+			}
+		}
+		// batch runs are shared between this many threads, which
+		// defaults to the number of processors. a single simulation
+		// shares the evaluation of its devices instead, on one by default
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+			threads = atoi(argv[++i]);
+			if(threads <= 0){
+				fprintf(stderr, "error: invalid thread count \"%s\"\r\n", argv[i]);
+				return -1;
+			}
+		}
+		// only find the dc operating point, and write the node voltages
+		else if(strcmp(argv[i], "--op") == 0){ op = 1; }
+		// time each phase of the run, and write a json report of it
+		else if(strcmp(argv[i], "--report") == 0 && i + 1 < argc){ report = argv[++i]; }
+		// save the state of the run every so many seconds, to carry on
+		// from with --resume if the run is stopped
+		else if(strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc){
+			checkpoint = atof(argv[++i]);
+			if(checkpoint <= 0){
+				fprintf(stderr, "error: invalid checkpoint interval \"%s\"\r\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i], "--resume") == 0){ resume = 1; }
+		else if(spec == NULL){ spec = argv[i]; }
+		else { results = argv[i]; }
+	}
+	if(spec == NULL){ return 0; }
+	
+	FILE *spec_f = fopen(spec, "r");
+	if(spec_f == NULL){
+		fprintf(stderr, "error: could not open file \"%s\"\r\n", spec);
+		return -1;
+	}
+	
+	sim_t s;
+	
+	double start = profileClock();
+	if(!parseFile(spec_f, &s)){
+		return -1;
+	}
+	//printf("file parsed\n");
+	fclose(spec_f);
+	if(report != NULL){
+		s.profiling = 1;
+		s.profile.seconds[phase_parse] = profileClock() - start;
+		s.profile.calls[phase_parse] = 1;
+	}
+	s.format = format;
+	s.single = single;
+	s.block_rows = block_rows;
+	s.precision = precision;
+	s.threads = (threads > 0)? threads : cpuCount();
+	s.eval_threads = (threads > 0)? threads : 1;
+	
+	// a batch writes its list of runs or statistics as csv,
+	// even when the runs themselves are binary
+	int batch = !op && (s.variations_count > 0 || s.runs > 1);
+	int binary = (format == format_binary) && !batch && !op;
+	if(results == NULL){
+		results = malloc(strlen(spec) + 20);
+		strcpy(results, spec);
+		strcpy(results + strlen(spec), binary? "_results.bin" : "_results.csv");
+	}
+	if(resume && (batch || op)){
+		fprintf(stderr, "error: only a single transient simulation can be resumed\r\n");
+		return -1;
+	}
+	
+	// the checkpoint is kept beside the results, which a resumed run adds to
+	char *checkpoint_file = malloc(strlen(results) + 6);
+	strcpy(checkpoint_file, results);
+	strcat(checkpoint_file, ".ckpt");
+	s.checkpoint_file = checkpoint_file;
+	s.checkpoint_interval = batch? 0 : checkpoint;
+	s.resume = resume;
+	
+	FILE *results_f = fopen(results, resume? (binary? "r+b" : "r+") : (binary? "wb" : "w"));
+	if(results_f == NULL){
+		fprintf(stderr, "error: could not open file \"%s\"\r\n", results);
+		return -1;
+	}
+	
+	if(op){
+		if(!simulateOp(&s, results_f)){
+			return -1;
+		}
+	} else if(batch){
+		if(!simulateBatch(&s, results_f, results)){
+			return -1;
+		}
+	} else if(!simulate(&s, results_f)){
+		return -1;
+	}
+	fclose(results_f);
+	
+	// the runs of a batch are copies, so only the parse of one is reported
+	if(report != NULL){
+		s.profile.total = profileClock() - start;
+		FILE *report_f = fopen(report, "w");
+		if(report_f == NULL || !profileReport(&s, report_f)){
+			fprintf(stderr, "error: could not write report \"%s\"\r\n", report);
+			return -1;
+		}
+		fclose(report_f);
+	}
+	return 0;
+}
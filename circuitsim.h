@@ -1,56 +1,547 @@
-/*
- * Author: Joslyn Renfrey
- * Date: 13/01/2023
- */
-
-#ifndef _CIRCUITSIM_H
-#define _CIRCUITSIM_H
-
-#include<stddef.h>
-#include<stdio.h>
-
-#define max_name_len 20
-#define max_terms 5
-#define max_params 5
-
-#define default_maxiter 10000
-#define default_errorsq 1e-18
-#define default_convrate 0.8
-
-#define COMPONENT_LIST( X ) X(res) X(src) X(ind) X(cap) X(dio) X(bjt)
-
-typedef struct {
-	char name[max_name_len + 1];
-	
-	int terminals_count; int terminals[max_params];
-	int parameters_count; double parameters[max_params];
-	
-	uint8_t is_measured;
-	
-	void (*currentCurve)(const double *parameters, const double *v, double timestep, double *i);
-	void (*jacobian)(const double *parameters, const double *v, double timestep, double *j);
-	void (*updateState)(double *parameters, const double *v, double timestep, const double *i);
-} component_t;
-
-typedef struct {
-	char name[max_name_len + 1];
-	
-	uint8_t is_fixed;
-	float fixed_voltage;
-	uint8_t is_measured;
-} node_t;
-
-typedef struct {
-	double errorsq, convrate;
-	double timestep, endtime;
-	int maxiter;
-	
-	int c_count, n_count;
-	component_t *c;
-	node_t *n;
-} sim_t;
-
-int parseFile(FILE *f, sim_t *s);
-int simulate(sim_t *s, FILE *f);
-
-#endif
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#ifndef _CIRCUITSIM_H
+#define _CIRCUITSIM_H
+
+#include<stddef.h>
+#include<stdint.h>
+#include<stdio.h>
+
+// long enough for the hierarchical names of subcircuit instances
+#define max_name_len 31
+#define max_terms 5
+// parameters from the .conf file come first, followed by any
+// state and constants derived from them by the component's setup
+#define max_params 8
+
+#define default_maxiter 10000
+#define default_errorsq 1e-18
+#define default_convrate 0.8
+
+// diagonal entries are preferred as sparse pivots if they are at least
+// this fraction of the largest candidate in their column
+#define sparse_pivot_tol 0.1
+// when reusing a pivot order, a pivot smaller than this fraction
+// of the rest of its column causes a fresh pivot search
+#define default_pivot_tol 1e-3
+// with chord newton, the factors are refreshed whenever an iteration
+// fails to reduce the squared error by at least this ratio
+#define chord_slow_ratio 0.25
+// iterative refinement of a solution from single precision factors
+// gives up after this many corrections, or once one does not help
+#define refine_maxiter 10
+
+// the dc operating point: a conductance of gmin connects every node to
+// ground, and is stepped down from op_gmin_start if newton's method does
+// not converge straight away. each attempt gets op_maxiter iterations
+#define default_gmin 1e-12
+#define op_gmin_start 1e-3
+#define op_maxiter 200
+
+// points in the table of exp used by the table device model
+#define default_table_points 2000
+
+// truncation error tolerances for adaptive time steps
+#define default_reltol 1e-3
+#define default_vntol 1e-6
+#define default_abstol 1e-12
+
+typedef enum { solver_dense, solver_sparse } solver_t;
+// format_memory keeps the records in memory instead of writing them,
+// for batch runs that are only used to gather statistics
+typedef enum { format_csv, format_binary, format_memory } format_t;
+
+#define COMPONENT_LIST( X ) X(res) X(src) X(ind) X(cap) X(dio) X(bjt)
+
+// how often a component's contribution has to be re-evaluated: never for
+// constant linear components, once per time step for linear components
+// with state (reactive), and every newton iteration for nonlinear ones
+typedef enum { linear_constant, linear_reactive, nonlinear } linearity_t;
+
+// the local truncation error of a component is acceptable when it is less
+// than reltol times the size of its state, plus vntol (volts) or abstol (amps)
+typedef struct {
+	double reltol, vntol, abstol;
+} tolerance_t;
+
+// the currents and jacobian of a component in one call, so that
+// whatever they have in common is only worked out once
+typedef void (*load_t)(const double *parameters, const double *v, double timestep, double *i, double *j);
+
+// nonlinear components can also be evaluated many at a time. parameters[k]
+// is the k'th parameter of every component, v[t] the voltage on terminal t of
+// every component, and the currents i[t] and jacobian elements j[k] are
+// written in the same way. components with no state need nothing else
+typedef void (*evalBatch_t)(int count, double *const *parameters, double *const *v, double timestep, double *const *i, double *const *j);
+
+// pn junction limiting: given the terminal voltages v_old the component was
+// last evaluated at, v is moved to where the component can safely be
+// evaluated. returns 1 if it was moved
+typedef int (*limit_t)(const double *parameters, const double *v_old, double *v);
+
+// newton steps are either scaled by convrate, or searched along for a
+// point that reduces the error enough
+typedef enum { damping_fixed, damping_linesearch } damping_t;
+#define linesearch_min_step (1.0/64)
+#define linesearch_decrease 1e-4
+
+// the highest order of polynomial the predictor can extrapolate with
+#define max_predictor 3
+// a prediction whose squared error is within this factor of the error the
+// last step started from is used without evaluating the last solution
+#define predictor_slack 4
+
+// batch kernels work through their components this many at a time
+#define device_batch 64
+
+// groups are evaluated in chunks of this many components, which are shared
+// out when a simulation has threads of its own. the chunks always start at
+// the same components (a multiple of device_batch), so the results do not
+// depend on the number of threads
+#define eval_chunk 1024
+
+// what every component of a type does, in one table for each type
+// (res_ops, src_ops, ...) which the components of that type point to.
+// a type only fills in what it needs: either load, or currentCurve and
+// jacobian, are always needed, and anything left out (NULL) is not done
+typedef struct {
+	int terminals_count, parameters_count;
+	linearity_t linearity;
+	
+	void (*setup)(double *parameters);
+	void (*currentCurve)(const double *parameters, const double *v, double timestep, double *i);
+	void (*jacobian)(const double *parameters, const double *v, double timestep, double *j);
+	void (*updateState)(double *parameters, const double *v, double timestep, const double *i);
+	double (*truncError)(const double *parameters, const double *v, double timestep, const double *i, const tolerance_t *tol);
+	load_t load;
+	evalBatch_t evalBatch;
+	// the component at dc, or NULL if it has no state and that is just load
+	load_t dcLoad;
+	limit_t limit;
+} component_ops_t;
+
+// a component holds only what the newton loop reads for it, in 48 bytes, so
+// that four fit in three cache lines. the terminal count and linearity are
+// copied from its type, as they are tested for every component. its name is
+// kept in the info_t of the same index, and where its jacobian elements go
+// in the simulator's jac_index
+typedef struct {
+	const component_ops_t *ops;
+	// the component's block of max_params in the simulator's parameters,
+	// which instances of a subcircuit share if the component has no state
+	double *parameters;
+	int terminals[max_terms];
+	int terminals_count;
+	linearity_t linearity;
+	// the first of its terminals_count squared elements of jac_index
+	int jac_start;
+} component_t;
+
+typedef struct {
+	uint8_t is_fixed;
+	double fixed_voltage;
+} node_t;
+
+// the name of a node or component, which is only
+// needed for parsing and labelling the output
+typedef struct {
+	char name[max_name_len + 1];
+	uint8_t is_measured;
+} info_t;
+
+// everything a simulation works out for itself is allocated from an arena,
+// aligned for cache lines (and vectors), and freed in one go with it
+#define arena_align 64
+#define arena_block_size (1 << 16)
+typedef struct {
+	struct arena_block *blocks;
+} arena_t;
+
+// the table model of the junction exponentials, which is read only once built
+typedef struct satexp_table satexp_table_t;
+
+// all of the components of one type that are evaluated in a batch, stored as
+// arrays of each parameter, terminal and jacobian index (structure of arrays)
+typedef struct {
+	evalBatch_t evalBatch;
+	int count, terminals_count, parameters_count;
+	int *components;
+	double *parameters[max_params];
+	int *terminals[max_terms];
+	int *jac_index[max_terms*max_terms];
+	
+	// terminal voltages in, currents and jacobian elements out
+	double *v[max_terms], *i[max_terms], *j[max_terms*max_terms];
+	// with limiting, how far each terminal voltage was moved from the real one
+	limit_t limit;
+	double *dv[max_terms];
+	uint8_t *chunk_limited;
+	
+	// the components are ordered by colour, and no two of one colour share a
+	// variable node, so the threads can add a colour in to e and jac at once.
+	// colour k is components color_start[k] to color_start[k + 1] - 1
+	int colors_count, *color_start;
+} device_group_t;
+
+// in place lu factors of a dense matrix, where the pivot order
+// is kept so that it can be reused by the next factorization.
+// single is set while the factors in lu_single are the newest
+typedef struct {
+	int n;
+	double *lu, *y;
+	float *lu_single;
+	int *rowperm, *colperm;
+	uint8_t factored, single;
+} dense_t;
+
+// compressed sparse column matrix over the variable nodes,
+// along with the space for its lu factorization
+typedef struct {
+	int n, nnz;
+	int *colptr, *rowind;
+	double *values;
+	
+	// fill reducing column ordering, and row pivot ordering (inverse)
+	int *q, *pinv;
+	
+	// L has a unit diagonal stored first in each column, U has its diagonal last
+	int l_space, u_space;
+	int *l_colptr, *l_rowind; double *l_values;
+	int *u_colptr, *u_rowind; double *u_values;
+	
+	// the same factors in single precision, while single is set
+	int single_space;
+	float *l_single, *u_single;
+	
+	// work space for factorization and solving
+	double *x; int *xi, *mark;
+	float *x_single;
+	uint8_t factored, single;
+} sparse_t;
+
+// counters reported at the end of a simulation
+typedef struct {
+	int factorizations, repivots, factor_reuses;
+	int steps, iters_total, iters_min, iters_max;
+	int rejected_lte, rejected_newton;
+	double step_min, step_max;
+	int op_iters, gmin_steps, source_steps;
+	int limited, backtracks;
+	int predicted, checked, fallbacks, iters_predicted, iters_unpredicted;
+	int refinements, refine_fallbacks;
+} stats_t;
+
+// the phases of a run that are timed when profiling
+typedef enum {
+	phase_parse, phase_eval, phase_assembly, phase_factor,
+	phase_solve, phase_update, phase_output, phases_count
+} phase_t;
+
+// bins of the histogram of newton iterations per solve
+#define profile_bins 32
+
+// where the time of a run went, only collected for --report. flops are
+// counted for the factorizations and substitutions, from the fill of the
+// factors, so they are the work done rather than the work of a dense matrix
+typedef struct {
+	double seconds[phases_count], flops[phases_count];
+	long long calls[phases_count];
+	double total, factor_flops, solve_flops;
+	// the flops of the factorizations on the longest thread, when partitioned
+	double span_flops, factor_span;
+	int lu_nnz;
+	int iters_hist[profile_bins];
+} profile_t;
+
+// output is formatted in to large buffers, which are handed
+// to a writer thread so that the simulation never waits on disk
+#define output_buffer_size (1 << 20)
+#define output_buffer_count 4
+#define default_precision 6
+
+// output of the measured values, one row per sample time
+typedef struct {
+	format_t format;
+	FILE *f;
+	int count, precision;
+	
+	// failed is set by a write without the writer thread that did not
+	// write everything, the writer thread keeps its own. base is where the
+	// buffered output starts in the file, and queued how much of it has
+	// been handed to the writer
+	char *buffer;
+	size_t fill;
+	struct writer *writer;
+	uint8_t failed;
+	long base;
+	size_t queued;
+	
+	// binary output: single precision records, and the number of rows
+	// in each column block (0 for plain rows)
+	uint8_t single;
+	int block_rows, block_fill;
+	double *block;
+	uint64_t rows;
+	
+	// in memory records, time first in each row
+	double *records;
+	size_t space;
+} output_t;
+
+// a run of a simulation, which is taken a step at a time: the arrays it
+// works on, and how far it has got, which is all a checkpoint needs besides
+// the state of the circuit. time is that of the next step, and with adaptive
+// steps sample is the next output sample, step the step to try next and
+// rec_last the record of the last accepted step. accepted is the time of the
+// last accepted step
+typedef struct {
+	double *v, *e, *jac;
+	int rec_count;
+	double *rec, *rec_last, *rec_sample, *v_last;
+	double time, sample, step, accepted;
+	uint8_t started;
+} run_t;
+
+// a component parameter that is changed between the runs of a batch.
+// sweeps step from one value to another (linearly, or logarithmically),
+// and monte carlo variations scale the value by a random factor, spread
+// being the relative half width (uniform) or standard deviation (gauss)
+typedef enum { vary_linear, vary_log, vary_uniform, vary_gauss } vary_t;
+typedef struct {
+	int component, parameter;
+	vary_t type;
+	double from, to, spread;
+	int points;
+} variation_t;
+
+// batch runs go to a file each, or are summarised in one statistics file
+#define default_seed 1
+typedef enum { batch_files, batch_stats } batch_mode_t;
+
+typedef struct {
+	double errorsq, convrate;
+	double timestep, endtime;
+	int maxiter;
+	
+	// with adaptive time steps, timestep is only the output interval and the
+	// first step. step is the time step currently being taken
+	uint8_t adaptive;
+	double step, minstep, maxstep;
+	tolerance_t tol;
+	solver_t solver;
+	uint8_t reuse_pivots;
+	// the sparse matrix can be split in to this many blocks, which are
+	// factorized in parallel, joined through a schur complement
+	int partitions;
+	struct bbd *bbd;
+	double pivot_tol;
+	
+	// chord newton: keep the factors while the jacobian changes
+	// by less than chord_tol, and convergence has not slowed
+	uint8_t chord, refactor;
+	double chord_tol;
+	double *jac_factored;
+	
+	// mixed precision: the jacobian is factorized in single precision (after
+	// a first double precision factorization that finds the pivot order), and
+	// each solution is refined with residuals worked out in double precision.
+	// if the refinement does not converge, the jacobian is factorized again
+	// in double precision. jac_norm is the largest row sum of the jacobian
+	// last factorized, refine_b and refine_r the right hand side and residual
+	uint8_t factor_single;
+	double jac_norm;
+	double *refine_b, *refine_r;
+	
+	// currents and jacobian of all the linear components, evaluated with the
+	// variable nodes at 0V. the constant part is built once, and the reactive
+	// part is added every time step, so only the nonlinear components need
+	// to be evaluated every iteration
+	double *jac_const, *e_const, *jac_linear, *e_linear, *v_fixed;
+	int nonlinear_count; int *nonlinear;
+	// nonlinear components with a batch evaluation are kept out of the
+	// nonlinear list, and are evaluated by type instead
+	int groups_count; device_group_t *groups;
+	// the currents of each nonlinear component (max_terms each) from the
+	// last evaluation, which once converged are those of the accepted step
+	double *currents;
+	
+	// junction limiting, with the terminal voltages each nonlinear component
+	// was last evaluated at (max_terms each). limited is set by an evaluation
+	// that had to limit, which can not be the converged solution
+	uint8_t limiting, limited;
+	double *v_last, *v_last_saved;
+	// the line search starts from v_base, in the direction of newton_step
+	damping_t damping;
+	double *v_base, *newton_step;
+	// e and jac already hold the evaluation at v, for the first iteration
+	uint8_t evaluated;
+	
+	// the predictor starts each step from a polynomial of this order through
+	// the voltages of the last accepted steps (newest first), instead of the
+	// last solution. 0 turns it off. the prediction is evaluated in to
+	// e_trial and jac_trial. if it has to be checked against the last
+	// solution, its currents and limiting are kept in currents_saved and
+	// v_last_trial. e_start is the squared error the last step started from
+	int predictor, history_count;
+	double *history, *prediction;
+	double *e_trial, *jac_trial, *currents_saved, *v_last_trial;
+	double e_start;
+	double history_time[max_predictor + 1];
+	
+	int c_count, n_count, var_n_count;
+	component_t *c;
+	node_t *n;
+	info_t *c_info, *n_info;
+	int params_count; double *params;
+	// for each element of each component's jacobian, where it is accumulated
+	// in the jacobian storage or -1 if it is not needed. made by matrixSetup
+	int *jac_index;
+	// the measured nodes and components, in the order they are recorded
+	int measured_n_count, measured_c_count;
+	int *measured_n, *measured_c;
+	arena_t arena;
+	
+	dense_t dense;
+	sparse_t sparse;
+	stats_t stats;
+	uint8_t profiling;
+	profile_t profile;
+	
+	// output settings, chosen on the command line
+	format_t format;
+	uint8_t single;
+	int block_rows, precision;
+	
+	// with table_points > 0, the junction exponentials of the diodes and
+	// transistors are interpolated from a table of that many points,
+	// which is built when the simulation starts
+	int table_points;
+	const satexp_table_t *table;
+	
+	// batch mode, where copies of this simulation are run
+	// on a pool of threads with their parameters varied
+	variation_t *variations;
+	int variations_count, runs, threads;
+	uint64_t seed;
+	batch_mode_t batch;
+	// the devices of a single simulation are evaluated by this many threads
+	int eval_threads;
+	struct pool *eval_pool;
+	// start from the dc operating point instead of 0V. the fixed voltages
+	// are scaled in to v_ramp while they are stepped up
+	uint8_t op;
+	double gmin;
+	double *v_ramp;
+	// the state of the run is saved to checkpoint_file every
+	// checkpoint_interval seconds (0 for never), and resume carries on
+	// from the one there, appending to the output
+	double checkpoint_interval;
+	const char *checkpoint_file;
+	uint8_t resume;
+	struct checkpoint *checkpoint;
+	// suppresses the statistics of each run
+	uint8_t quiet;
+	// the records of a format_memory simulation
+	double *records;
+	size_t records_rows;
+} sim_t;
+
+// a fixed set of worker threads, that share out the tasks of each poolRun.
+// the calling thread works on the tasks too
+typedef struct pool pool_t;
+int cpuCount(void);
+pool_t *poolCreate(int threads);
+void poolRun(pool_t *p, int count, void (*task)(void *ctx, int index), void *ctx);
+void poolDestroy(pool_t *p);
+
+void *arenaAlloc(arena_t *a, size_t size);
+void *arenaCopy(arena_t *a, const void *p, size_t size);
+void arenaFree(arena_t *a);
+
+// an open addressing hash table of node or component names. it holds indices
+// in to the array of nodes or components, where the name of index i is found
+// at base + i*stride. the array can move as it grows, so base is given each time
+typedef struct {
+	int *slots;
+	int space, count;
+} name_table_t;
+int tableFind(const name_table_t *t, const char *base, size_t stride, const char *name);
+void tableInsert(name_table_t *t, const char *base, size_t stride, int index);
+
+int parseFile(FILE *f, sim_t *s);
+int parseText(const char *text, size_t len, sim_t *s);
+// the steps of parseText, for a circuit that is built a piece at a time
+typedef struct parser parser_t;
+parser_t *parseStart(sim_t *s);
+int parseLines(parser_t *p, const char *text, size_t len);
+int parseNode(parser_t *p, const char *name);
+int parseComponent(parser_t *p, const char *type, const char *name, const char *const *nodes, const double *parameters);
+int parseFixed(parser_t *p, const char *name, double voltage);
+int parseFinish(parser_t *p);
+void parseFree(parser_t *p);
+int simulate(sim_t *s, FILE *f);
+int simulateOp(sim_t *s, FILE *f);
+int runStart(sim_t *s, run_t *run);
+int runStep(sim_t *s, run_t *run, output_t *o);
+int runDone(sim_t *s, run_t *run);
+void simChanged(sim_t *s);
+int simCopy(sim_t *s, const sim_t *t);
+void simFree(sim_t *s);
+int simulateBatch(sim_t *t, FILE *f, const char *results);
+
+void satExpBatch(int n, const double *x, double *y, double *dy);
+satexp_table_t *satExpTable(arena_t *a, int points);
+void satExpTableError(const satexp_table_t *t, double *value_error, double *deriv_error);
+void satExpUse(const satexp_table_t *t);
+
+int recordSize(sim_t *s);
+int formatValue(char *p, double x, int precision);
+const char *recordLabel(sim_t *s, int index, const char **unit);
+int outputOpen(output_t *o, sim_t *s, FILE *f);
+void outputRecord(output_t *o, double time, const double *rec);
+long outputQueued(output_t *o);
+int outputWait(output_t *o, long length);
+int outputClose(output_t *o);
+
+int matrixSetup(sim_t *s);
+void matrixFree(sim_t *s);
+void denseSetup(dense_t *d, int n);
+int denseFactor(dense_t *d, const double *A, int rowskip, int full_pivoting, double pivot_tol);
+int denseFactorSingle(dense_t *d, const double *A, int rowskip, double pivot_tol);
+void denseSolve(dense_t *d, double *b);
+void denseSolveSingle(dense_t *d, double *b);
+int sparseFactor(sparse_t *m);
+int sparseRefactor(sparse_t *m, double pivot_tol);
+int sparseRefactorSingle(sparse_t *m, double pivot_tol);
+void sparseSolve(sparse_t *m, double *b);
+void sparseSolveFrom(sparse_t *m, double *b, int first);
+void sparseSolveSingle(sparse_t *m, double *b);
+void sparseFlops(const sparse_t *m, double *factor, double *solve);
+void sparsePrepare(sparse_t *m);
+void sparseBuild(sparse_t *m, int n, int count, const int *rows, const int *cols);
+int sparseIndex(const sparse_t *m, int row, int col);
+void sparseRelease(sparse_t *m);
+int bbdSetup(sim_t *s);
+void bbdFree(sim_t *s);
+int bbdFactor(sim_t *s, const double *jac);
+void bbdSolve(sim_t *s, double *e);
+void bbdWork(sim_t *s, double *factor, double *solve, double *span, int *lu_nnz);
+
+void checkpointStart(sim_t *s);
+int checkpointDue(sim_t *s);
+void checkpointSave(sim_t *s, output_t *o, const run_t *run);
+int checkpointLoad(sim_t *s, output_t *o, run_t *run);
+void checkpointWait(sim_t *s);
+void checkpointFinish(sim_t *s, int ok);
+
+double profileClock(void);
+double profileStart(sim_t *s);
+double profileLap(sim_t *s, phase_t phase, double since);
+void profileFactorWork(sim_t *s);
+void profileIterations(sim_t *s, int iters);
+int profileReport(const sim_t *s, FILE *f);
+
+#endif
@@ -1,114 +1,159 @@
-/*
- * Author: Joslyn Renfrey
- * Date: 13/01/2023
- */
-
-#include"circuitsim.h"
-
-const int res_terminals_count = 2;
-const int res_parameters_count = 1;
-
-void res_currentCurve(const double *parameters, const double *v, double timestep, double *i){
-	double res = parameters[0];
-	double current = (v[0] - v[1])/res;
-	i[0] =  current;
-	i[1] = -current;
-}
-
-void res_jacobian(const double *parameters, const double *v, double timestep, double *j){
-	double res = parameters[0];
-	double slope = 1/res;
-	j[0] =  slope; j[1] = -slope;
-	j[2] = -slope; j[3] =  slope;
-}
-
-void res_updateState(double *parameters, const double *v, double timestep, const double *i){}
-
-
-
-const int src_terminals_count = 2;
-const int src_parameters_count = 2;
-
-void src_currentCurve(const double *parameters, const double *v, double timestep, double *i){
-	double max_v = parameters[0];
-	double max_i = parameters[1];
-	double res = max_v/max_i;
-	double current = (v[0] - v[1] - max_v)/res;
-	
-	i[0] =  current;
-	i[1] = -current;
-}
-
-void src_jacobian(const double *parameters, const double *v, double timestep, double *j){
-	double max_v = parameters[0];
-	double max_i = parameters[1];
-	double res = max_v/max_i;
-	
-	double slope = 1/res;
-	j[0] =  slope; j[1] = -slope;
-	j[2] = -slope; j[3] =  slope;
-}
-
-void src_updateState(double *parameters, const double *v, double timestep, const double *i){}
-
-
-
-const int cap_terminals_count = 2;
-const int cap_parameters_count = 2;
-
-void cap_currentCurve(const double *parameters, const double *v, double timestep, double *i){
-	double cap = parameters[0];
-	double past_v = parameters[1];
-	double past_i = parameters[2];
-	// we use a trapezoidal approximation, which has much better convergence properties
-	// i = c.dv/dt
-	double mean_i = ( v[0] - v[1] - past_v)*(cap/timestep);
-	// mean_i = (i + past_i)/2, 2*mean_i - past_i = i
-	double current = 2*mean_i - past_i;
-	i[0] =  current;
-	i[1] = -current;
-}
-
-void cap_jacobian(const double *parameters, const double *v, double timestep, double *j){
-	double cap = parameters[0];
-	double slope = 2*cap/timestep;
-	j[0] =  slope; j[1] = -slope;
-	j[2] = -slope; j[3] =  slope;
-}
-
-void cap_updateState(double *parameters, const double *v, double timestep, const double *i){
-	parameters[1] = v[0] - v[1];
-	parameters[2] = (i[0] - i[1])/2;
-}
-
-
-
-const int ind_terminals_count = 2;
-const int ind_parameters_count = 2;
-
-void ind_currentCurve(const double *parameters, const double *v, double timestep, double *i){
-	double ind = parameters[0];
-	double past_i = parameters[1];
-	double past_v = parameters[2];
-	
-	// we use a trapezoidal approximation, which has much better convergence properties
-	double mean_v = (v[0] - v[1] + past_v)/2;
-	// v = l.di/dt
-	// i + di = i + v.dt/l
-	double current = mean_v*(timestep/ind) + past_i;
-	i[0] =  current;
-	i[1] = -current;
-}
-
-void ind_jacobian(const double *parameters, const double *v, double timestep, double *j){
-	double ind = parameters[0];
-	double slope = 0.5*timestep/ind;
-	j[0] =  slope; j[1] = -slope;
-	j[2] = -slope; j[3] =  slope;
-}
-
-void ind_updateState(double *parameters, const double *v, double timestep, const double *i){
-	parameters[1] = (i[0] - i[1])/2;
-	parameters[2] = v[0] - v[1];
-}
-
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<math.h>
+
+// local truncation error of the trapezoidal rule, h^3/12 x''', where x' = f
+// is known at the new point, the last point and the one before that, a step
+// of h_prev earlier. returns 0 until there is enough history
+static double trapezoidalError(double f_new, double f_old, double f_older, double h, double h_prev){
+	if(h_prev <= 0){ return 0; }
+	double f_dd = 2*((f_new - f_old)/h - (f_old - f_older)/h_prev)/(h + h_prev);
+	return fabs(h*h*h*f_dd/12);
+}
+
+static void res_load(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double res = parameters[0];
+	double current = (v[0] - v[1])/res;
+	double slope = 1/res;
+	i[0] =  current;
+	i[1] = -current;
+	j[0] =  slope; j[1] = -slope;
+	j[2] = -slope; j[3] =  slope;
+}
+
+const component_ops_t res_ops = {
+	.terminals_count = 2, .parameters_count = 1,
+	.linearity = linear_constant,
+	.load = res_load,
+};
+
+
+
+static void src_load(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double max_v = parameters[0];
+	double max_i = parameters[1];
+	double res = max_v/max_i;
+	double current = (v[0] - v[1] - max_v)/res;
+	double slope = 1/res;
+	i[0] =  current;
+	i[1] = -current;
+	j[0] =  slope; j[1] = -slope;
+	j[2] = -slope; j[3] =  slope;
+}
+
+const component_ops_t src_ops = {
+	.terminals_count = 2, .parameters_count = 2,
+	.linearity = linear_constant,
+	.load = src_load,
+};
+
+
+
+static void cap_load(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double cap = parameters[0];
+	double past_v = parameters[1];
+	double past_i = parameters[2];
+	// we use a trapezoidal approximation, which has much better convergence properties
+	// i = c.dv/dt
+	double mean_i = ( v[0] - v[1] - past_v)*(cap/timestep);
+	// mean_i = (i + past_i)/2, 2*mean_i - past_i = i
+	double current = 2*mean_i - past_i;
+	double slope = 2*cap/timestep;
+	i[0] =  current;
+	i[1] = -current;
+	j[0] =  slope; j[1] = -slope;
+	j[2] = -slope; j[3] =  slope;
+}
+
+static void cap_updateState(double *parameters, const double *v, double timestep, const double *i){
+	// the older current and the step since then are kept for truncError
+	parameters[3] = parameters[2];
+	parameters[4] = timestep;
+	parameters[1] = v[0] - v[1];
+	parameters[2] = (i[0] - i[1])/2;
+}
+
+static double cap_truncError(const double *parameters, const double *v, double timestep, const double *i, const tolerance_t *tol){
+	double cap = parameters[0];
+	double past_v = parameters[1];
+	double v_new = v[0] - v[1];
+	// the voltage error, since dv/dt = i/c
+	double error = trapezoidalError((i[0] - i[1])/(2*cap), parameters[2]/cap, parameters[3]/cap, timestep, parameters[4]);
+	return error/(tol->reltol*fmax(fabs(v_new), fabs(past_v)) + tol->vntol);
+}
+
+// a capacitor is open at dc
+static void cap_dc(const double *parameters, const double *v, double timestep, double *i, double *j){
+	i[0] = 0; i[1] = 0;
+	j[0] = 0; j[1] = 0;
+	j[2] = 0; j[3] = 0;
+}
+
+const component_ops_t cap_ops = {
+	.terminals_count = 2, .parameters_count = 2,
+	.linearity = linear_reactive,
+	.updateState = cap_updateState,
+	.truncError = cap_truncError,
+	.load = cap_load,
+	.dcLoad = cap_dc,
+};
+
+
+
+static void ind_load(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double ind = parameters[0];
+	double past_i = parameters[1];
+	double past_v = parameters[2];
+	// we use a trapezoidal approximation, which has much better convergence properties
+	double mean_v = (v[0] - v[1] + past_v)/2;
+	// v = l.di/dt
+	// i + di = i + v.dt/l
+	double current = mean_v*(timestep/ind) + past_i;
+	double slope = 0.5*timestep/ind;
+	i[0] =  current;
+	i[1] = -current;
+	j[0] =  slope; j[1] = -slope;
+	j[2] = -slope; j[3] =  slope;
+}
+
+static void ind_updateState(double *parameters, const double *v, double timestep, const double *i){
+	// the older voltage and the step since then are kept for truncError
+	parameters[3] = parameters[2];
+	parameters[4] = timestep;
+	parameters[1] = (i[0] - i[1])/2;
+	parameters[2] = v[0] - v[1];
+}
+
+static double ind_truncError(const double *parameters, const double *v, double timestep, const double *i, const tolerance_t *tol){
+	double ind = parameters[0];
+	double past_i = parameters[1];
+	double i_new = (i[0] - i[1])/2;
+	// the current error, since di/dt = v/l
+	double error = trapezoidalError((v[0] - v[1])/ind, parameters[2]/ind, parameters[3]/ind, timestep, parameters[4]);
+	return error/(tol->reltol*fmax(fabs(i_new), fabs(past_i)) + tol->abstol);
+}
+
+// an inductor is a short at dc, which is approximated by a large conductance
+// so that its terminals stay separate nodes
+#define ind_dc_conductance 1e4
+static void ind_dc(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double current = (v[0] - v[1])*ind_dc_conductance;
+	i[0] =  current;
+	i[1] = -current;
+	j[0] =  ind_dc_conductance; j[1] = -ind_dc_conductance;
+	j[2] = -ind_dc_conductance; j[3] =  ind_dc_conductance;
+}
+
+const component_ops_t ind_ops = {
+	.terminals_count = 2, .parameters_count = 2,
+	.linearity = linear_reactive,
+	.updateState = ind_updateState,
+	.truncError = ind_truncError,
+	.load = ind_load,
+	.dcLoad = ind_dc,
+};
+
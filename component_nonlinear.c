@@ -1,109 +1,387 @@
-/*
- * Author: Joslyn Renfrey
- * Date: 13/01/2023
- */
-
-#include"circuitsim.h"
-#include<math.h>
-
-// a saturating exponential that has a maximum derivative
-#define SATEXP_THRESHOLD 21.0
-double satExp(double x){
-	if(x > SATEXP_THRESHOLD){
-		double y_thresh = exp(SATEXP_THRESHOLD);
-		return y_thresh*(x - SATEXP_THRESHOLD) + y_thresh;
-	}
-	return exp(x);
-}
-double derivSatExp(double x){
-	return exp(x > SATEXP_THRESHOLD ? SATEXP_THRESHOLD : x);
-}
-
-
-
-const int dio_terminals_count = 2;
-const int dio_parameters_count = 3;
-
-void dio_currentCurve(const double *parameters, const double *v, double timestep, double *i){
-	double v_on  = parameters[0];
-	double i_on  = parameters[1];
-	double i_leak = parameters[2];
-	
-	double v_th = v_on/log(1 + i_on/i_leak);
-	double current = i_leak*(satExp((v[0] - v[1])/v_th) - 1);
-	
-	i[0] =  current;
-	i[1] = -current;
-}
-
-void dio_jacobian(const double *parameters, const double *v, double timestep, double *j){
-	double v_on  = parameters[0];
-	double i_on  = parameters[1];
-	double i_leak = parameters[2];
-	
-	double v_th = v_on/log(1 + i_on/i_leak);
-	double slope = i_leak*derivSatExp((v[0] - v[1])/v_th)/v_th;
-	
-	j[0] =  slope; j[1] = -slope;
-	j[2] = -slope; j[3] =  slope;
-}
-
-void dio_updateState(double *parameters, const double *v, double timestep, const double *i){}
-
-
-
-const int bjt_terminals_count = 3;
-const int bjt_parameters_count = 4;
-
-void bjt_currentCurve(const double *parameters, const double *v, double timestep, double *i){
-	double beta     = parameters[0];
-	double v_be_on  = parameters[1];
-	double i_c_on   = parameters[2];
-	double i_c_off  = parameters[3];
-	
-	double alpha_fwd = beta/(1 + beta);
-	double alpha_rev = (0.1*beta)/(1 + 0.1*beta);
-	double v_th = v_be_on/log(1 + i_c_on/(alpha_fwd*i_c_off));
-	
-	double i_ediode = i_c_off*(satExp((v[1] - v[2])/v_th) - 1);
-	double i_cdiode = i_c_off*(satExp((v[1] - v[0])/v_th) - 1);
-	
-	i[0] = alpha_fwd*i_ediode - i_cdiode;
-	i[1] = i_ediode*(1 - alpha_fwd) + i_cdiode*(1 - alpha_rev);
-	i[2] = alpha_rev*i_cdiode - i_ediode;
-}
-
-void bjt_jacobian(const double *parameters, const double *v, double timestep, double *j){
-	double beta     = parameters[0];
-	double v_be_on  = parameters[1];
-	double i_c_on   = parameters[2];
-	double i_c_off  = parameters[3];
-	
-	double alpha_fwd = beta/(1 + beta);
-	double alpha_rev = (0.25*beta)/(1 + 0.25*beta);
-	double v_th = v_be_on/log(1 + i_c_on/(alpha_fwd*i_c_off));
-	
-	double i_ediode_d_dvb = i_c_off*derivSatExp((v[1] - v[2])/v_th)/v_th;
-	double i_cdiode_d_dvb = i_c_off*derivSatExp((v[1] - v[0])/v_th)/v_th;
-	double i_ediode_d_dve = -i_ediode_d_dvb;
-	double i_cdiode_d_dvc = -i_cdiode_d_dvb;
-	double i_cdiode_d_dve = 0;
-	double i_ediode_d_dvc = 0;
-	
-	// ic derivatives w.r.t c, b, e
-	j[0] = alpha_fwd*i_ediode_d_dvc - i_cdiode_d_dvc;
-	j[1] = alpha_fwd*i_ediode_d_dvb - i_cdiode_d_dvb;
-	j[2] = alpha_fwd*i_ediode_d_dve - i_cdiode_d_dve;
-
-	// ib derivatives w.r.t. c,b,e
-	j[3] = i_ediode_d_dvc*(1 - alpha_fwd) + i_cdiode_d_dvc*(1 - alpha_rev);
-	j[4] = i_ediode_d_dvb*(1 - alpha_fwd) + i_cdiode_d_dvb*(1 - alpha_rev);	
-	j[5] = i_ediode_d_dve*(1 - alpha_fwd) + i_cdiode_d_dve*(1 - alpha_rev);
-	
-	// ie derivatives w.r.t. c,b,e
-	j[6] = alpha_rev*i_cdiode_d_dvc - i_ediode_d_dvc;
-	j[7] = alpha_rev*i_cdiode_d_dvb - i_ediode_d_dvb;
-	j[8] = alpha_rev*i_cdiode_d_dve - i_ediode_d_dve;
-}
-
-void bjt_updateState(double *parameters, const double *v, double timestep, const double *i){}
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<math.h>
+#include<stdlib.h>
+// gcc and clang can compile the vector kernels for x86-64 without any flags
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(__TINYC__)
+#define SATEXP_SIMD
+#include<immintrin.h>
+#endif
+
+// a saturating exponential that has a maximum derivative
+#define SATEXP_THRESHOLD 21.0
+
+// the table model replaces exp by cubic hermite interpolation between points
+// spread evenly from TABLE_MIN up to the threshold, using the exact slope at
+// each point, which for exp is just its value. below TABLE_MIN the table is
+// extended linearly (down to 0), just as satExp is above the threshold.
+// each simulation builds its own table, which is not changed after that.
+// the devices have no way to reach their simulation, so the simulator
+// names the table its thread is to use with satExpUse before evaluating
+#define TABLE_MIN -40.0
+struct satexp_table {
+	int points;
+	double step, *y;
+	double value_error, deriv_error;
+};
+static _Thread_local const satexp_table_t *table;
+
+static double tableSatExp(const satexp_table_t *table, double x, double *dy){
+	if(x >= SATEXP_THRESHOLD){
+		double y_thresh = table->y[table->points - 1];
+		*dy = y_thresh;
+		return y_thresh*(x - SATEXP_THRESHOLD) + y_thresh;
+	}
+	if(x <= TABLE_MIN){
+		double y = table->y[0]*(1 + (x - TABLE_MIN));
+		*dy = (y > 0)? table->y[0] : 0;
+		return (y > 0)? y : 0;
+	}
+	double u = (x - TABLE_MIN)/table->step;
+	int k = (int) u;
+	if(k > table->points - 2){ k = table->points - 2; }
+	double t = u - k, t2 = t*t, t3 = t2*t;
+	double y0 = table->y[k], y1 = table->y[k + 1];
+	double d0 = y0*table->step, d1 = y1*table->step;
+	// the slope is that of the interpolation, so newton's method sees a consistent model
+	*dy = (6*(t2 - t)*(y0 - y1) + (3*t2 - 4*t + 1)*d0 + (3*t2 - 2*t)*d1)/table->step;
+	return (2*t3 - 3*t2 + 1)*y0 + (t3 - 2*t2 + t)*d0 + (3*t2 - 2*t3)*y1 + (t3 - t2)*d1;
+}
+
+double satExp(double x){
+	if(table != NULL){
+		double dy;
+		return tableSatExp(table, x, &dy);
+	}
+	if(x > SATEXP_THRESHOLD){
+		double y_thresh = exp(SATEXP_THRESHOLD);
+		return y_thresh*(x - SATEXP_THRESHOLD) + y_thresh;
+	}
+	return exp(x);
+}
+double derivSatExp(double x){
+	if(table != NULL){
+		double dy;
+		tableSatExp(table, x, &dy);
+		return dy;
+	}
+	return exp(x > SATEXP_THRESHOLD ? SATEXP_THRESHOLD : x);
+}
+
+// a table model of this many points, kept in a. the largest error
+// relative to exp is measured in between the points
+satexp_table_t *satExpTable(arena_t *a, int points){
+	satexp_table_t *t = arenaAlloc(a, sizeof(satexp_table_t));
+	double step = (SATEXP_THRESHOLD - TABLE_MIN)/(points - 1);
+	double *y = arenaAlloc(a, sizeof(double)*points);
+	for(int k = 0; k < points - 1; k++){ y[k] = exp(TABLE_MIN + k*step); }
+	y[points - 1] = exp(SATEXP_THRESHOLD);
+	t->step = step;
+	t->y = y;
+	t->points = points;
+	
+	for(int k = 0; k < points - 1; k++){
+		for(int m = 1; m < 8; m++){
+			double x = TABLE_MIN + (k + m/8.0)*step, dy;
+			double value = tableSatExp(t, x, &dy), exact = exp(x);
+			double value_error = fabs(value - exact)/exact, deriv_error = fabs(dy - exact)/exact;
+			if(value_error > t->value_error){ t->value_error = value_error; }
+			if(deriv_error > t->deriv_error){ t->deriv_error = deriv_error; }
+		}
+	}
+	return t;
+}
+
+void satExpTableError(const satexp_table_t *t, double *value_error, double *deriv_error){
+	*value_error = t->value_error;
+	*deriv_error = t->deriv_error;
+}
+
+// the table the devices evaluated by this thread use, or NULL for exp
+void satExpUse(const satexp_table_t *t){
+	table = t;
+}
+
+#ifdef SATEXP_SIMD
+// exp(x) = 2^n exp(r), with n = round(x/ln2) so that |r| <= ln2/2, where a
+// degree 12 taylor series is accurate to a few ulp. 2^n is added straight
+// on to the exponent bits, which is why x is kept within [-700, 700].
+// the kernels are compiled for their own instruction sets, whatever the
+// rest of the file is compiled for, and satExpBatch picks one at run time.
+// each returns how many of the n values it has done, a whole number of vectors
+#define EXP_LN2_HI 6.93147180369123816490e-01
+#define EXP_LN2_LO 1.90821492927058770002e-10
+static const double exp_coeffs[] = {
+	1.0/479001600, 1.0/39916800, 1.0/3628800, 1.0/362880, 1.0/40320, 1.0/5040,
+	1.0/720, 1.0/120, 1.0/24, 1.0/6, 1.0/2, 1.0, 1.0
+};
+
+__attribute__((target("avx512f")))
+static inline __m512d expVector512(__m512d x){
+	x = _mm512_min_pd(_mm512_max_pd(x, _mm512_set1_pd(-700)), _mm512_set1_pd(700));
+	__m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(M_LOG2E)), _MM_FROUND_TO_NEAREST_INT);
+	__m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(EXP_LN2_HI), x);
+	r = _mm512_fnmadd_pd(n, _mm512_set1_pd(EXP_LN2_LO), r);
+	__m512d p = _mm512_set1_pd(exp_coeffs[0]);
+	for(int k = 1; k < 13; k++){ p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(exp_coeffs[k])); }
+	// n + 1.5*2^52 has n in its low bits
+	__m512d magic = _mm512_set1_pd(6755399441055744.0);
+	__m512i ni = _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(n, magic)), _mm512_castpd_si512(magic));
+	return _mm512_castsi512_pd(_mm512_add_epi64(_mm512_castpd_si512(p), _mm512_slli_epi64(ni, 52)));
+}
+
+__attribute__((target("avx512f")))
+static int satExpBatch512(int n, const double *x, double *y, double *dy){
+	__m512d thresh = _mm512_set1_pd(SATEXP_THRESHOLD), one = _mm512_set1_pd(1), zero = _mm512_setzero_pd();
+	int k = 0;
+	for(; k + 8 <= n; k += 8){
+		__m512d xv = _mm512_loadu_pd(x + k);
+		__m512d e = expVector512(_mm512_min_pd(xv, thresh));
+		__m512d over = _mm512_max_pd(_mm512_sub_pd(xv, thresh), zero);
+		_mm512_storeu_pd(y + k, _mm512_mul_pd(e, _mm512_add_pd(one, over)));
+		_mm512_storeu_pd(dy + k, e);
+	}
+	return k;
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d expVector256(__m256d x){
+	x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-700)), _mm256_set1_pd(700));
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(M_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(EXP_LN2_HI), x);
+	r = _mm256_fnmadd_pd(n, _mm256_set1_pd(EXP_LN2_LO), r);
+	__m256d p = _mm256_set1_pd(exp_coeffs[0]);
+	for(int k = 1; k < 13; k++){ p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(exp_coeffs[k])); }
+	__m256d magic = _mm256_set1_pd(6755399441055744.0);
+	__m256i ni = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, magic)), _mm256_castpd_si256(magic));
+	return _mm256_castsi256_pd(_mm256_add_epi64(_mm256_castpd_si256(p), _mm256_slli_epi64(ni, 52)));
+}
+
+__attribute__((target("avx2,fma")))
+static int satExpBatch256(int n, const double *x, double *y, double *dy){
+	__m256d thresh = _mm256_set1_pd(SATEXP_THRESHOLD), one = _mm256_set1_pd(1), zero = _mm256_setzero_pd();
+	int k = 0;
+	for(; k + 4 <= n; k += 4){
+		__m256d xv = _mm256_loadu_pd(x + k);
+		__m256d e = expVector256(_mm256_min_pd(xv, thresh));
+		__m256d over = _mm256_max_pd(_mm256_sub_pd(xv, thresh), zero);
+		_mm256_storeu_pd(y + k, _mm256_mul_pd(e, _mm256_add_pd(one, over)));
+		_mm256_storeu_pd(dy + k, e);
+	}
+	return k;
+}
+#endif
+
+// y = satExp(x) and dy = derivSatExp(x) for n values at once. both come
+// from e = exp(min(x, threshold)), as satExp(x) = e*(1 + max(x - threshold, 0))
+void satExpBatch(int n, const double *x, double *y, double *dy){
+	int k = 0;
+	if(table != NULL){
+		for(; k < n; k++){ y[k] = tableSatExp(table, x[k], dy + k); }
+		return;
+	}
+#ifdef SATEXP_SIMD
+	if(__builtin_cpu_supports("avx512f")){ k = satExpBatch512(n, x, y, dy); }
+	else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){ k = satExpBatch256(n, x, y, dy); }
+#endif
+	// whatever is left, or everything without simd
+	for(; k < n; k++){
+		y[k] = satExp(x[k]);
+		dy[k] = derivSatExp(x[k]);
+	}
+}
+
+
+
+// spice's pn junction limiting. a forward voltage that has jumped by more than
+// two thermal voltages, past the voltage where the current starts to rise
+// quickly (v_crit), is pulled back to where the exponential would have grown
+// as much as its slope at v_old predicted. sets *limited if it moves v_new
+static double junctionLimit(double v_new, double v_old, double v_th, double v_crit, int *limited){
+	if(v_new <= v_crit || fabs(v_new - v_old) <= 2*v_th){ return v_new; }
+	*limited = 1;
+	if(v_old > 0){
+		double arg = 1 + (v_new - v_old)/v_th;
+		return (arg > 0)? v_old + v_th*log(arg) : v_crit;
+	}
+	return v_th*log(v_new/v_th);
+}
+
+// the voltage at which a junction with a leakage current of i_leak starts to
+// conduct enough that newton's method can overshoot
+static double criticalVoltage(double v_th, double i_leak){
+	return v_th*log(v_th/(M_SQRT2*i_leak));
+}
+
+// the thermal voltage that gives a current of i_on at v_on
+static void dio_setup(double *parameters){
+	double v_on  = parameters[0];
+	double i_on  = parameters[1];
+	double i_leak = parameters[2];
+	parameters[3] = v_on/log(1 + i_on/i_leak);
+	parameters[4] = criticalVoltage(parameters[3], i_leak);
+}
+
+static void dio_load(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double i_leak = parameters[2];
+	double v_th = parameters[3];
+	double x = (v[0] - v[1])/v_th;
+	double current = i_leak*(satExp(x) - 1);
+	double slope = i_leak*derivSatExp(x)/v_th;
+	
+	i[0] =  current;
+	i[1] = -current;
+	j[0] =  slope; j[1] = -slope;
+	j[2] = -slope; j[3] =  slope;
+}
+
+static void dio_batch(int count, double *const *parameters, double *const *v, double timestep, double *const *i, double *const *j){
+	double x[device_batch], y[device_batch], dy[device_batch];
+	for(int start = 0; start < count; start += device_batch){
+		int n = (count - start < device_batch)? count - start : device_batch;
+		const double *i_leak = parameters[2] + start, *v_th = parameters[3] + start;
+		const double *v0 = v[0] + start, *v1 = v[1] + start;
+		
+		for(int k = 0; k < n; k++){
+			x[k] = (v0[k] - v1[k])/v_th[k];
+		}
+		satExpBatch(n, x, y, dy);
+		
+		double *i0 = i[0] + start, *i1 = i[1] + start;
+		double *j0 = j[0] + start, *j1 = j[1] + start, *j2 = j[2] + start, *j3 = j[3] + start;
+		for(int k = 0; k < n; k++){
+			double current = i_leak[k]*(y[k] - 1);
+			double slope = i_leak[k]*dy[k]/v_th[k];
+			i0[k] =  current; i1[k] = -current;
+			j0[k] =  slope; j1[k] = -slope;
+			j2[k] = -slope; j3[k] =  slope;
+		}
+	}
+}
+
+static int dio_limitJunction(const double *parameters, const double *v_old, double *v){
+	int limited = 0;
+	double v_d = junctionLimit(v[0] - v[1], v_old[0] - v_old[1], parameters[3], parameters[4], &limited);
+	if(limited){ v[0] = v[1] + v_d; }
+	return limited;
+}
+
+const component_ops_t dio_ops = {
+	.terminals_count = 2, .parameters_count = 3,
+	.linearity = nonlinear,
+	.setup = dio_setup,
+	.load = dio_load,
+	.evalBatch = dio_batch,
+	.limit = dio_limitJunction,
+};
+
+
+
+// the common base current gains, and the thermal voltage that gives
+// a collector current of i_c_on at v_be_on
+static void bjt_setup(double *parameters){
+	double beta     = parameters[0];
+	double v_be_on  = parameters[1];
+	double i_c_on   = parameters[2];
+	double i_c_off  = parameters[3];
+	
+	double alpha_fwd = beta/(1 + beta);
+	parameters[4] = alpha_fwd;
+	parameters[5] = (0.1*beta)/(1 + 0.1*beta);
+	parameters[6] = v_be_on/log(1 + i_c_on/(alpha_fwd*i_c_off));
+	parameters[7] = criticalVoltage(parameters[6], i_c_off);
+}
+
+static void bjt_load(const double *parameters, const double *v, double timestep, double *i, double *j){
+	double i_c_off   = parameters[3];
+	double alpha_fwd = parameters[4];
+	double alpha_rev = parameters[5];
+	double v_th      = parameters[6];
+	
+	double x_e = (v[1] - v[2])/v_th, x_c = (v[1] - v[0])/v_th;
+	double i_ediode = i_c_off*(satExp(x_e) - 1);
+	double i_cdiode = i_c_off*(satExp(x_c) - 1);
+	i[0] = alpha_fwd*i_ediode - i_cdiode;
+	i[1] = i_ediode*(1 - alpha_fwd) + i_cdiode*(1 - alpha_rev);
+	i[2] = alpha_rev*i_cdiode - i_ediode;
+	
+	// only the diode derivatives w.r.t. their own terminals are non-zero
+	double de = i_c_off*derivSatExp(x_e)/v_th;
+	double dc = i_c_off*derivSatExp(x_c)/v_th;
+	j[0] = dc;
+	j[1] = alpha_fwd*de - dc;
+	j[2] = -alpha_fwd*de;
+	j[3] = -dc*(1 - alpha_rev);
+	j[4] = de*(1 - alpha_fwd) + dc*(1 - alpha_rev);
+	j[5] = -de*(1 - alpha_fwd);
+	j[6] = -alpha_rev*dc;
+	j[7] = alpha_rev*dc - de;
+	j[8] = de;
+}
+
+// the emitter diode exponents go in the first half of x, the collector diode in the second
+static void bjt_batch(int count, double *const *parameters, double *const *v, double timestep, double *const *i, double *const *j){
+	double x[2*device_batch], y[2*device_batch], dy[2*device_batch];
+	for(int start = 0; start < count; start += device_batch){
+		int n = (count - start < device_batch)? count - start : device_batch;
+		const double *i_c_off = parameters[3] + start;
+		const double *alpha_fwd = parameters[4] + start, *alpha_rev = parameters[5] + start;
+		const double *v_th = parameters[6] + start;
+		const double *vc = v[0] + start, *vb = v[1] + start, *ve = v[2] + start;
+		
+		for(int k = 0; k < n; k++){
+			x[k] = (vb[k] - ve[k])/v_th[k];
+			x[n + k] = (vb[k] - vc[k])/v_th[k];
+		}
+		satExpBatch(2*n, x, y, dy);
+		
+		for(int k = 0; k < n; k++){
+			double af = alpha_fwd[k], ar = alpha_rev[k];
+			double i_ediode = i_c_off[k]*(y[k] - 1);
+			double i_cdiode = i_c_off[k]*(y[n + k] - 1);
+			i[0][start + k] = af*i_ediode - i_cdiode;
+			i[1][start + k] = i_ediode*(1 - af) + i_cdiode*(1 - ar);
+			i[2][start + k] = ar*i_cdiode - i_ediode;
+			
+			// only the diode derivatives w.r.t. their own terminals are non-zero
+			double de = i_c_off[k]*dy[k]/v_th[k];
+			double dc = i_c_off[k]*dy[n + k]/v_th[k];
+			j[0][start + k] = dc;
+			j[1][start + k] = af*de - dc;
+			j[2][start + k] = -af*de;
+			j[3][start + k] = -dc*(1 - ar);
+			j[4][start + k] = de*(1 - af) + dc*(1 - ar);
+			j[5][start + k] = -de*(1 - af);
+			j[6][start + k] = -ar*dc;
+			j[7][start + k] = ar*dc - de;
+			j[8][start + k] = de;
+		}
+	}
+}
+
+// both junctions are limited, with the base voltage kept where it is
+static int bjt_limitJunction(const double *parameters, const double *v_old, double *v){
+	int limited = 0;
+	double v_th = parameters[6], v_crit = parameters[7];
+	double v_be = junctionLimit(v[1] - v[2], v_old[1] - v_old[2], v_th, v_crit, &limited);
+	double v_bc = junctionLimit(v[1] - v[0], v_old[1] - v_old[0], v_th, v_crit, &limited);
+	if(limited){
+		v[2] = v[1] - v_be;
+		v[0] = v[1] - v_bc;
+	}
+	return limited;
+}
+
+const component_ops_t bjt_ops = {
+	.terminals_count = 3, .parameters_count = 4,
+	.linearity = nonlinear,
+	.setup = bjt_setup,
+	.load = bjt_load,
+	.evalBatch = bjt_batch,
+	.limit = bjt_limitJunction,
+};
+
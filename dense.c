@@ -0,0 +1,172 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<math.h>
+#include<string.h>
+#include<stdlib.h>
+
+#define swap(x, y) {double temp = x; x = y; y = temp; }
+#define swapInt(x, y) {int temp = x; x = y; y = temp; }
+
+void denseSetup(dense_t *d, int n){
+	d->n = n;
+	d->lu = malloc(sizeof(double)*(n*n + 1));
+	d->rowperm = malloc(sizeof(int)*(n + 1));
+	d->colperm = malloc(sizeof(int)*(n + 1));
+	d->y = malloc(sizeof(double)*(n + 1));
+	d->lu_single = NULL;
+	d->factored = d->single = 0;
+	for(int i = 0; i < n; i++){ d->rowperm[i] = d->colperm[i] = i; }
+}
+
+// lu factorization of the top left n*n block of A. with full pivoting, the
+// greatest element of the remaining sub matrix is searched for every pivot.
+// otherwise the permutations from the last factorization are reused, and
+// it returns -1 if a pivot has become too small relative to its column
+int denseFactor(dense_t *d, const double *A, int rowskip, int full_pivoting, double pivot_tol){
+	int n = d->n;
+	double *lu = d->lu;
+
+	// copy A into the factor storage, already permuted if reusing pivots
+	if(full_pivoting){
+		for(int i = 0; i < n; i++){ d->rowperm[i] = d->colperm[i] = i; }
+	}
+	for(int row = 0; row < n; row++){
+		const double *src = A + rowskip*d->rowperm[row];
+		for(int col = 0; col < n; col++){ lu[n*row + col] = src[d->colperm[col]]; }
+	}
+	d->factored = d->single = 0;
+
+	for(int pivot = 0; pivot < n; pivot++){
+		if(full_pivoting){
+			// search for the greatest element in the remaining sub matrix
+			int swaprow = pivot, swapcol = pivot;
+			double swap_mag = fabs(lu[n*pivot + pivot]);
+			for(int row = pivot; row < n; row++){
+				for(int col = pivot; col < n; col++){
+					double candidate_mag = fabs(lu[n*row + col]);
+					if(candidate_mag > swap_mag){
+						swap_mag = candidate_mag, swaprow = row, swapcol = col;
+					}
+				}
+			}
+
+			// swap the whole row, including the multipliers already stored
+			for(int col = 0; col < n; col++){
+				swap(lu[n*swaprow + col], lu[n*pivot + col]);
+			}
+			// and swap the column
+			for(int row = 0; row < n; row++){
+				swap(lu[n*row + pivot], lu[n*row + swapcol]);
+			}
+			swapInt(d->rowperm[swaprow], d->rowperm[pivot]);
+			swapInt(d->colperm[swapcol], d->colperm[pivot]);
+		} else {
+			// a cheap check that the old pivot is still good: it should not
+			// be much smaller than anything else left in its column
+			double col_max = 0;
+			for(int row = pivot + 1; row < n; row++){
+				double mag = fabs(lu[n*row + pivot]);
+				if(mag > col_max){ col_max = mag; }
+			}
+			double mag = fabs(lu[n*pivot + pivot]);
+			if(mag == 0 || mag < pivot_tol*col_max){ return -1; }
+		}
+
+		if(lu[n*pivot + pivot] == 0){ return 0; }
+
+		// eliminate pivot column of all lower rows by row scale and subtract,
+		// leaving the scale behind as the lower factor
+		for(int row = pivot + 1; row < n; row++){
+			double scale = lu[n*row + pivot]/lu[n*pivot + pivot];
+			lu[n*row + pivot] = scale;
+			if(scale == 0){ continue; }
+			for(int col = pivot + 1; col < n; col++){
+				lu[n*row + col] -= scale*lu[n*pivot + col];
+			}
+		}
+	}
+	d->factored = 1;
+	return 1;
+}
+
+// lu factorization in single precision, in to lu_single, with the pivot
+// order of the last denseFactor, which must have succeeded. it returns -1 if
+// a pivot has become too small as denseFactor does when reusing pivots, and
+// 0 if the factors do not fit in single precision
+int denseFactorSingle(dense_t *d, const double *A, int rowskip, double pivot_tol){
+	int n = d->n;
+	d->single = 0;
+	if(d->lu_single == NULL){ d->lu_single = malloc(sizeof(float)*(n*n + 1)); }
+	float *lu = d->lu_single;
+	for(int row = 0; row < n; row++){
+		const double *src = A + rowskip*d->rowperm[row];
+		for(int col = 0; col < n; col++){ lu[n*row + col] = src[d->colperm[col]]; }
+	}
+
+	for(int pivot = 0; pivot < n; pivot++){
+		float col_max = 0;
+		for(int row = pivot + 1; row < n; row++){
+			float mag = fabsf(lu[n*row + pivot]);
+			if(mag > col_max){ col_max = mag; }
+		}
+		float mag = fabsf(lu[n*pivot + pivot]);
+		if(!isfinite(mag) || !isfinite(col_max)){ return 0; }
+		if(mag == 0 || mag < pivot_tol*col_max){ return -1; }
+
+		for(int row = pivot + 1; row < n; row++){
+			float scale = lu[n*row + pivot]/lu[n*pivot + pivot];
+			lu[n*row + pivot] = scale;
+			if(scale == 0){ continue; }
+			for(int col = pivot + 1; col < n; col++){
+				lu[n*row + col] -= scale*lu[n*pivot + col];
+			}
+		}
+	}
+	d->single = 1;
+	return 1;
+}
+
+// solve A x = b using the lu factors, result is stored in b
+void denseSolve(dense_t *d, double *b){
+	int n = d->n;
+	double *lu = d->lu, *y = d->y;
+	for(int row = 0; row < n; row++){ y[row] = b[d->rowperm[row]]; }
+	// forward substitution with the unit lower factor
+	for(int row = 0; row < n; row++){
+		double sum = y[row];
+		for(int col = 0; col < row; col++){ sum -= lu[n*row + col]*y[col]; }
+		y[row] = sum;
+	}
+	// back substitution with the upper factor
+	for(int row = n - 1; row >= 0; row--){
+		double sum = y[row];
+		for(int col = row + 1; col < n; col++){ sum -= lu[n*row + col]*y[col]; }
+		y[row] = sum/lu[n*row + row];
+	}
+	// undo the column permutation
+	for(int col = 0; col < n; col++){ b[d->colperm[col]] = y[col]; }
+}
+
+// denseSolve with the single precision factors, where the
+// substitution itself is still carried out in double precision
+void denseSolveSingle(dense_t *d, double *b){
+	int n = d->n;
+	const float *lu = d->lu_single;
+	double *y = d->y;
+	for(int row = 0; row < n; row++){ y[row] = b[d->rowperm[row]]; }
+	for(int row = 0; row < n; row++){
+		double sum = y[row];
+		for(int col = 0; col < row; col++){ sum -= lu[n*row + col]*y[col]; }
+		y[row] = sum;
+	}
+	for(int row = n - 1; row >= 0; row--){
+		double sum = y[row];
+		for(int col = row + 1; col < n; col++){ sum -= lu[n*row + col]*y[col]; }
+		y[row] = sum/lu[n*row + row];
+	}
+	for(int col = 0; col < n; col++){ b[d->colperm[col]] = y[col]; }
+}
@@ -0,0 +1,97 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#ifndef _LIBCIRCUITSIM_H
+#define _LIBCIRCUITSIM_H
+
+#include<stddef.h>
+
+/*
+ * circuitsim as a library, to run simulations from another program without
+ * files or text output. build it with "make lib", which makes
+ * libcircuitsim.a and libcircuitsim.so, and link with -lm -lpthread.
+ *
+ * a circuit is loaded from the text of a .conf file, then started and
+ * stepped through time, in the time steps of the .conf file. between steps
+ * the voltages of fixed nodes and the parameters of components can be
+ * changed. the voltages and currents are read straight from the arrays of
+ * the simulator, which are made when the circuit is started and stay where
+ * they are until it is freed, and hold the last accepted step.
+ *
+ *   circuit_t *c = circuitLoad(text, strlen(text));
+ *   int out = circuitNode(c, "vc1"), supply = circuitNode(c, "vcc");
+ *   circuitStart(c);
+ *   const double *v = circuitVoltages(c);
+ *   while(circuitStep(c, 1) == 1){
+ *       circuitSetVoltage(c, supply, 5 + 0.1*sin(1e3*circuitTime(c)));
+ *       ... v[out] ...
+ *   }
+ *   circuitFree(c);
+ *
+ * a circuit can also be built without any text. circuitNew takes the lines
+ * of a .conf file that set up the simulation, such as the time step and
+ * solver, which can be NULL for the defaults. the nodes and components are
+ * then added by name, and a node can be named by a component before it is
+ * added, as in a .conf file. nodes are sorted when the circuit is finished,
+ * so circuitNode can only be used after circuitFinish.
+ *
+ *   circuit_t *c = circuitNew(settings, strlen(settings));
+ *   circuitAddNode(c, "vin"); circuitAddNode(c, "vout");
+ *   circuitSetFixed(c, "vin", 1);
+ *   circuitSetFixed(c, "gnd", 0);
+ *   double r[] = {1e3}, cap[] = {1e-6};
+ *   circuitAddComponent(c, "res", "R1", (const char *[]){"vin", "vout"}, r);
+ *   circuitAddComponent(c, "cap", "C1", (const char *[]){"vout", "gnd"}, cap);
+ *   circuitFinish(c);
+ *
+ * functions that return int return 0 (or -1 for circuitStep) when they
+ * fail, and write the reason to stderr like circuitsim itself.
+ */
+
+typedef struct circuit circuit_t;
+
+// parse a circuit. a circuit that has not been started can be copied many
+// times, which is much quicker than parsing it again for each simulation
+circuit_t *circuitLoad(const char *text, size_t len);
+// build a circuit, which has to be finished before it is copied or started.
+// the type of a component is a built in type, such as "res" or "dio", or a
+// subcircuit defined in the settings. nodes has one name for each of its
+// terminals, and parameters its parameters in the order of a .conf file
+circuit_t *circuitNew(const char *settings, size_t len);
+int circuitAddNode(circuit_t *c, const char *name);
+int circuitAddComponent(circuit_t *c, const char *type, const char *name, const char *const *nodes, const double *parameters);
+int circuitSetFixed(circuit_t *c, const char *node, double voltage);
+int circuitFinish(circuit_t *c);
+circuit_t *circuitCopy(const circuit_t *c);
+void circuitFree(circuit_t *c);
+
+// start at time 0, or at the dc operating point if the .conf file asks for
+// it, then take up to steps time steps. circuitStep returns the number of
+// steps taken, which is less than asked once the end time is reached
+int circuitStart(circuit_t *c);
+int circuitStep(circuit_t *c, int steps);
+// the time of the last accepted step
+double circuitTime(const circuit_t *c);
+
+// the index of a node or component, or -1 if there is none of that name
+int circuitNode(const circuit_t *c, const char *name);
+int circuitComponent(const circuit_t *c, const char *name);
+
+// the voltage of every node, by index. the currents are circuit_terms to a
+// component, the current in to the circuit from each of its terminals. the
+// current through a component with two terminals is (i[0] - i[1])/2, as
+// written by circuitsim
+#define circuit_terms 5
+const double *circuitVoltages(const circuit_t *c);
+const double *circuitCurrents(const circuit_t *c);
+
+// only the voltages of nodes that were "set" can be changed. parameter 0 is
+// the first parameter of the component, as in the .conf file. the
+// components of a subcircuit that have no state share their parameters
+// with the same component of the other instances
+int circuitSetVoltage(circuit_t *c, int node, double voltage);
+int circuitSetParameter(circuit_t *c, int component, int parameter, double value);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include"libcircuitsim.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#if circuit_terms != max_terms
+#error "circuit_terms must be the same as max_terms"
+#endif
+
+// the simulation, and its run once it has been started. the names of its
+// nodes and components are hashed, as they are looked up for every run.
+// parser is only there while the circuit is being built
+struct circuit {
+	sim_t s;
+	run_t run;
+	parser_t *parser;
+	uint8_t finished, started;
+	name_table_t node_names, component_names;
+};
+
+#define nodeNames ((const char *) c->s.n_info + offsetof(info_t, name)), sizeof(info_t)
+#define componentNames ((const char *) c->s.c_info + offsetof(info_t, name)), sizeof(info_t)
+
+static void hashNames(circuit_t *c){
+	for(int i = 0; i < c->s.n_count; i++){ tableInsert(&c->node_names, nodeNames, i); }
+	for(int i = 0; i < c->s.c_count; i++){ tableInsert(&c->component_names, componentNames, i); }
+}
+
+circuit_t *circuitLoad(const char *text, size_t len){
+	circuit_t *c = calloc(1, sizeof(circuit_t));
+	if(!parseText(text, len, &c->s)){
+		free(c);
+		return NULL;
+	}
+	c->s.quiet = 1;
+	c->finished = 1;
+	hashNames(c);
+	return c;
+}
+
+circuit_t *circuitNew(const char *settings, size_t len){
+	circuit_t *c = calloc(1, sizeof(circuit_t));
+	c->parser = parseStart(&c->s);
+	if(settings != NULL && !parseLines(c->parser, settings, len)){
+		parseFree(c->parser);
+		free(c);
+		return NULL;
+	}
+	c->s.quiet = 1;
+	return c;
+}
+
+static int building(circuit_t *c){
+	if(c->parser == NULL){
+		fprintf(stderr, "error: nodes and components can only be added before the circuit is finished\n");
+		return 0;
+	}
+	return 1;
+}
+
+int circuitAddNode(circuit_t *c, const char *name){
+	return building(c) && parseNode(c->parser, name);
+}
+
+int circuitAddComponent(circuit_t *c, const char *type, const char *name, const char *const *nodes, const double *parameters){
+	return building(c) && parseComponent(c->parser, type, name, nodes, parameters);
+}
+
+int circuitSetFixed(circuit_t *c, const char *node, double voltage){
+	return building(c) && parseFixed(c->parser, node, voltage);
+}
+
+int circuitFinish(circuit_t *c){
+	if(!building(c)){ return 0; }
+	// the parser is freed whether or not it worked
+	int ok = parseFinish(c->parser);
+	c->parser = NULL;
+	if(!ok){ return 0; }
+	c->finished = 1;
+	hashNames(c);
+	return 1;
+}
+
+static int finished(const circuit_t *c){
+	if(!c->finished){
+		fprintf(stderr, "error: the circuit has not been finished\n");
+		return 0;
+	}
+	return 1;
+}
+
+circuit_t *circuitCopy(const circuit_t *c){
+	if(!finished(c)){ return NULL; }
+	if(c->started){
+		fprintf(stderr, "error: a circuit can only be copied before it is started\n");
+		return NULL;
+	}
+	circuit_t *copy = calloc(1, sizeof(circuit_t));
+	if(!simCopy(&copy->s, &c->s)){
+		free(copy);
+		return NULL;
+	}
+	// the list of variations is shared with the original
+	copy->s.variations = NULL;
+	copy->s.variations_count = 0;
+	copy->finished = 1;
+	hashNames(copy);
+	return copy;
+}
+
+void circuitFree(circuit_t *c){
+	if(c == NULL){ return; }
+	if(c->parser != NULL){ parseFree(c->parser); }
+	free(c->s.variations);
+	simFree(&c->s);
+	free(c->node_names.slots);
+	free(c->component_names.slots);
+	free(c);
+}
+
+int circuitStart(circuit_t *c){
+	if(c->started){
+		fprintf(stderr, "error: the circuit has already been started\n");
+		return 0;
+	}
+	if(!finished(c)){ return 0; }
+	// a run that could not be set up can not be stepped
+	if(!runStart(&c->s, &c->run)){ return 0; }
+	c->started = 1;
+	return 1;
+}
+
+int circuitStep(circuit_t *c, int steps){
+	if(!c->started){
+		fprintf(stderr, "error: the circuit has not been started\n");
+		return -1;
+	}
+	int taken = 0;
+	for(; taken < steps && !runDone(&c->s, &c->run); taken++){
+		if(!runStep(&c->s, &c->run, NULL)){ return -1; }
+	}
+	return taken;
+}
+
+double circuitTime(const circuit_t *c){
+	return c->run.accepted;
+}
+
+int circuitNode(const circuit_t *c, const char *name){
+	return tableFind(&c->node_names, nodeNames, name);
+}
+
+int circuitComponent(const circuit_t *c, const char *name){
+	return tableFind(&c->component_names, componentNames, name);
+}
+
+const double *circuitVoltages(const circuit_t *c){
+	return c->run.v;
+}
+
+const double *circuitCurrents(const circuit_t *c){
+	return c->s.currents;
+}
+
+int circuitSetVoltage(circuit_t *c, int node, double voltage){
+	if(node < 0 || node >= c->s.n_count || !c->s.n[node].is_fixed){
+		fprintf(stderr, "error: node %i is not a fixed node\n", node);
+		return 0;
+	}
+	node_t *n = c->s.n + node;
+	n->fixed_voltage = voltage;
+	if(c->started){
+		c->run.v[node] = n->fixed_voltage;
+		simChanged(&c->s);
+	}
+	return 1;
+}
+
+int circuitSetParameter(circuit_t *c, int component, int parameter, double value){
+	if(component < 0 || component >= c->s.c_count ||
+		parameter < 0 || parameter >= c->s.c[component].ops->parameters_count){
+		fprintf(stderr, "error: component %i has no parameter %i\n", component, parameter);
+		return 0;
+	}
+	c->s.c[component].parameters[parameter] = value;
+	if(c->started){ simChanged(&c->s); }
+	return 1;
+}
@@ -0,0 +1,417 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include"waveform.h"
+#include<stdio.h>
+#include<string.h>
+#include<stdlib.h>
+#include<math.h>
+#include<pthread.h>
+
+// buffers go round in a ring: the simulation fills the one at head, while
+// the writer thread writes out the queued ones from tail onwards
+struct writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	FILE *f;
+	char *buffers[output_buffer_count];
+	size_t fill[output_buffer_count];
+	int head, tail, queued;
+	uint8_t done, failed;
+	// bytes written out so far
+	size_t written;
+};
+
+static void *writerThread(void *arg){
+	struct writer *w = arg;
+	pthread_mutex_lock(&w->lock);
+	for(;;){
+		while(w->queued == 0 && !w->done){ pthread_cond_wait(&w->changed, &w->lock); }
+		if(w->queued == 0){ break; }
+		int i = w->tail;
+		// the buffer stays queued while it is written, so it is not reused
+		pthread_mutex_unlock(&w->lock);
+		size_t written = fwrite(w->buffers[i], 1, w->fill[i], w->f);
+		pthread_mutex_lock(&w->lock);
+		if(written != w->fill[i]){ w->failed = 1; }
+		w->written += w->fill[i];
+		w->tail = (w->tail + 1)%output_buffer_count;
+		w->queued--;
+		pthread_cond_broadcast(&w->changed);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void startWriter(output_t *o){
+	o->base = ftell(o->f);
+	struct writer *w = calloc(1, sizeof(struct writer));
+	w->f = o->f;
+	for(int i = 0; i < output_buffer_count; i++){
+		w->buffers[i] = malloc(output_buffer_size);
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->changed, NULL);
+	if(pthread_create(&w->thread, NULL, writerThread, w) != 0){
+		// no thread, so just write each buffer as it fills up
+		o->buffer = w->buffers[0];
+		for(int i = 1; i < output_buffer_count; i++){ free(w->buffers[i]); }
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->changed);
+		free(w);
+		o->writer = NULL;
+		return;
+	}
+	o->writer = w;
+	o->buffer = w->buffers[w->head];
+}
+
+// hand the current buffer to the writer thread, and wait for a free one
+static void flushBuffer(output_t *o){
+	struct writer *w = o->writer;
+	o->queued += o->fill;
+	if(w == NULL){
+		if(fwrite(o->buffer, 1, o->fill, o->f) != o->fill){ o->failed = 1; }
+		o->fill = 0;
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	w->fill[w->head] = o->fill;
+	w->head = (w->head + 1)%output_buffer_count;
+	w->queued++;
+	pthread_cond_broadcast(&w->changed);
+	while(w->queued == output_buffer_count){ pthread_cond_wait(&w->changed, &w->lock); }
+	pthread_mutex_unlock(&w->lock);
+	o->buffer = w->buffers[w->head];
+	o->fill = 0;
+}
+
+// write everything still buffered, and stop the writer thread
+static int stopWriter(output_t *o){
+	struct writer *w = o->writer;
+	if(o->fill > 0){ flushBuffer(o); }
+	if(w == NULL){
+		free(o->buffer);
+		return !o->failed;
+	}
+	pthread_mutex_lock(&w->lock);
+	w->done = 1;
+	pthread_cond_broadcast(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	int ok = !w->failed;
+	for(int i = 0; i < output_buffer_count; i++){ free(w->buffers[i]); }
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->changed);
+	free(w);
+	o->writer = NULL;
+	return ok;
+}
+
+static void outputWrite(output_t *o, const void *data, size_t len){
+	const char *p = data;
+	while(len > 0){
+		if(o->fill == output_buffer_size){ flushBuffer(o); }
+		size_t n = output_buffer_size - o->fill;
+		if(n > len){ n = len; }
+		memcpy(o->buffer + o->fill, p, n);
+		o->fill += n, p += n, len -= n;
+	}
+}
+
+static const double powers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double scale10(double x, int k){
+	while(k > 22){ x *= 1e22; k -= 22; }
+	while(k < -22){ x /= 1e22; k += 22; }
+	return (k >= 0)? x*powers[k] : x/powers[-k];
+}
+
+// the same as sprintf(p, "%.*e", precision, x), without going through
+// printf. the digits are found by scaling x so that they form an integer,
+// and the few values that land too close to a rounding boundary for
+// that to be exact are left to sprintf. tools/formatcheck.c compares the two
+int formatValue(char *p, double x, int precision){
+	double mag = fabs(x);
+	if(!isfinite(x) || precision > 15 || (mag < 1e-290 && mag != 0)){
+		return sprintf(p, "%.*e", precision, x);
+	}
+	char *start = p;
+	if(signbit(x)){ *p++ = '-'; }
+	
+	int e = 0;
+	uint64_t digits = 0;
+	if(mag != 0){
+		e = (int) floor(log10(mag));
+		double scaled = scale10(mag, precision - e);
+		if(scaled >= powers[precision + 1]){ e++; scaled = scale10(mag, precision - e); }
+		else if(scaled < powers[precision]){ e--; scaled = scale10(mag, precision - e); }
+		double whole = floor(scaled), frac = scaled - whole;
+		if(fabs(frac - 0.5) < scaled*1e-13 + 1e-9){
+			return sprintf(start, "%.*e", precision, x);
+		}
+		digits = (uint64_t) whole + (frac > 0.5);
+		if(digits >= (uint64_t) powers[precision + 1]){ digits /= 10; e++; }
+	}
+	
+	char text[20] = {0};
+	for(int i = precision; i >= 0; i--){ text[i] = '0' + digits%10; digits /= 10; }
+	*p++ = text[0];
+	if(precision > 0){
+		*p++ = '.';
+		memcpy(p, text + 1, precision);
+		p += precision;
+	}
+	*p++ = 'e';
+	*p++ = (e < 0)? '-' : '+';
+	e = abs(e);
+	if(e >= 100){ *p++ = '0' + e/100; e %= 100; }
+	*p++ = '0' + e/10;
+	*p++ = '0' + e%10;
+	return p - start;
+}
+
+// the number of measured values in each row of output, excluding time
+int recordSize(sim_t *s){
+	int count = 0;
+	for(int i = 0; i < s->n_count; i++){
+		if(s->n_info[i].is_measured){ count++; }
+	}
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c_info[i].is_measured && s->c[i].terminals_count == 2){ count += 2; }
+	}
+	return count;
+}
+
+// the name and unit of a measured value, in the same order as the records
+const char *recordLabel(sim_t *s, int index, const char **unit){
+	for(int i = 0; i < s->n_count; i++){
+		if(s->n_info[i].is_measured && index-- == 0){
+			*unit = "V";
+			return s->n_info[i].name;
+		}
+	}
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c_info[i].is_measured && s->c[i].terminals_count == 2){
+			if(index < 2){
+				*unit = (index == 0)? "V" : "A";
+				return s->c_info[i].name;
+			}
+			index -= 2;
+		}
+	}
+	*unit = "";
+	return "";
+}
+
+static void printLabels(sim_t *s, FILE *f){
+	fprintf(f, "time(s)");
+	// print labels for measured nodes
+	for(int i = 0; i < s->n_count; i++){
+		if(s->n_info[i].is_measured){
+			fprintf(f, ", %s(V)", s->n_info[i].name);
+		}
+	}
+	// print labels for components that are being measured (only supports 2 terminal devices)
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c_info[i].is_measured && s->c[i].terminals_count == 2){
+			fprintf(f, ", %s(V), %s(A)", s->c_info[i].name, s->c_info[i].name);
+		}
+	}
+	fprintf(f, "\n");
+}
+
+// signal names and units are collected in a table, so that the
+// size of the header is known before it is written
+typedef struct {
+	char *data;
+	size_t len, space;
+} table_t;
+
+static void addSignal(table_t *t, const char *name, const char *unit){
+	size_t needed = t->len + strlen(name) + strlen(unit) + 2;
+	if(needed > t->space){
+		t->space = 2*needed;
+		t->data = realloc(t->data, t->space);
+	}
+	strcpy(t->data + t->len, name); t->len += strlen(name) + 1;
+	strcpy(t->data + t->len, unit); t->len += strlen(unit) + 1;
+}
+
+// the binary header has the same signals as the csv labels, with the
+// names and units stored separately
+static int writeHeader(output_t *o, sim_t *s){
+	table_t t = {0};
+	addSignal(&t, "time", "s");
+	for(int i = 0; i < s->n_count; i++){
+		if(s->n_info[i].is_measured){ addSignal(&t, s->n_info[i].name, "V"); }
+	}
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c_info[i].is_measured && s->c[i].terminals_count == 2){
+			addSignal(&t, s->c_info[i].name, "V");
+			addSignal(&t, s->c_info[i].name, "A");
+		}
+	}
+	
+	wave_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, wave_magic, sizeof(h.magic));
+	h.version = wave_version;
+	h.flags = o->single? wave_flag_float : 0;
+	h.signal_count = o->count + 1;
+	h.block_rows = o->block_rows;
+	// pad so that the data is aligned for whoever maps the file
+	h.data_offset = (sizeof(h) + t.len + 7)/8*8;
+	
+	fwrite(&h, sizeof(h), 1, o->f);
+	fwrite(t.data, 1, t.len, o->f);
+	for(size_t pos = sizeof(h) + t.len; pos < h.data_offset; pos++){ fputc(0, o->f); }
+	free(t.data);
+	// the rest goes through the writer thread
+	fflush(o->f);
+	return !ferror(o->f);
+}
+
+int outputOpen(output_t *o, sim_t *s, FILE *f){
+	memset(o, 0, sizeof(output_t));
+	o->format = s->format;
+	o->f = f;
+	o->count = recordSize(s);
+	o->single = s->single;
+	o->block_rows = s->block_rows;
+	o->precision = s->precision;
+
+	if(o->format == format_memory){
+		return 1;
+	}
+	// a resumed run appends to the output it already has
+	if(s->resume){
+		if(o->block_rows > 0){
+			o->block = calloc((size_t) o->block_rows*(o->count + 1), sizeof(double));
+		}
+		startWriter(o);
+		return 1;
+	}
+	if(o->format == format_csv){
+		printLabels(s, f);
+		fflush(f);
+		startWriter(o);
+		return 1;
+	}
+	if(o->block_rows > 0){
+		o->block = calloc((size_t) o->block_rows*(o->count + 1), sizeof(double));
+	}
+	if(!writeHeader(o, s)){
+		fprintf(stderr, "error: could not write output header\n");
+		return 0;
+	}
+	startWriter(o);
+	return 1;
+}
+
+static void writeValues(output_t *o, const double *values, int count){
+	if(!o->single){
+		outputWrite(o, values, sizeof(double)*count);
+		return;
+	}
+	float buffer[256];
+	for(int i = 0; i < count; i += 256){
+		int n = (count - i < 256)? count - i : 256;
+		for(int j = 0; j < n; j++){ buffer[j] = values[i + j]; }
+		outputWrite(o, buffer, sizeof(float)*n);
+	}
+}
+
+// write out a column block, which is stored column by column already
+static void flushBlock(output_t *o){
+	writeValues(o, o->block, o->block_rows*(o->count + 1));
+	memset(o->block, 0, sizeof(double)*o->block_rows*(o->count + 1));
+	o->block_fill = 0;
+}
+
+void outputRecord(output_t *o, double time, const double *rec){
+	o->rows++;
+	if(o->format == format_memory){
+		size_t width = o->count + 1;
+		if(o->rows*width > o->space){
+			o->space = 2*o->rows*width;
+			o->records = realloc(o->records, sizeof(double)*o->space);
+		}
+		double *row = o->records + (o->rows - 1)*width;
+		row[0] = time;
+		memcpy(row + 1, rec, sizeof(double)*o->count);
+	} else if(o->format == format_csv){
+		// make sure a whole row fits in the buffer
+		size_t row_len = (size_t) (o->count + 1)*(o->precision + 12) + 2;
+		if(o->fill + row_len > output_buffer_size){ flushBuffer(o); }
+		char *p = o->buffer + o->fill;
+		p += formatValue(p, time, o->precision);
+		for(int i = 0; i < o->count; i++){
+			*p++ = ','; *p++ = ' ';
+			p += formatValue(p, rec[i], o->precision);
+		}
+		*p++ = '\n';
+		o->fill = p - o->buffer;
+	} else if(o->block_rows > 0){
+		o->block[o->block_fill] = time;
+		for(int i = 0; i < o->count; i++){
+			o->block[(i + 1)*o->block_rows + o->block_fill] = rec[i];
+		}
+		if(++o->block_fill == o->block_rows){ flushBlock(o); }
+	} else {
+		writeValues(o, &time, 1);
+		writeValues(o, rec, o->count);
+	}
+}
+
+// hand every whole row so far to the writer, and return the length the
+// output file will have once they are written, without waiting for them.
+// the rows of an unfinished column block are still held in o->block
+long outputQueued(output_t *o){
+	if(o->fill > 0){ flushBuffer(o); }
+	return (o->base < 0)? -1 : o->base + (long) o->queued;
+}
+
+// wait, on any thread, until the output file is at least length long.
+// returns 0 if it could not be written
+int outputWait(output_t *o, long length){
+	struct writer *w = o->writer;
+	int ok = !o->failed;
+	if(w != NULL){
+		pthread_mutex_lock(&w->lock);
+		while(o->base + (long) w->written < length && !w->failed){ pthread_cond_wait(&w->changed, &w->lock); }
+		ok = !w->failed;
+		pthread_mutex_unlock(&w->lock);
+	}
+	return ok && fflush(o->f) == 0 && !ferror(o->f);
+}
+
+int outputClose(output_t *o){
+	if(o->format == format_memory){
+		return 1;
+	}
+	if(o->format == format_binary && o->block_fill > 0){ flushBlock(o); }
+	int ok = stopWriter(o);
+	if(o->format == format_binary){
+		free(o->block);
+
+		// now the number of rows is known, fill it in if we can seek
+		long end = ftell(o->f);
+		if(end >= 0 && fseek(o->f, offsetof(wave_header_t, row_count), SEEK_SET) == 0){
+			fwrite(&o->rows, sizeof(o->rows), 1, o->f);
+			fseek(o->f, 0, SEEK_END);
+		}
+	}
+	if(!ok || fflush(o->f) != 0 || ferror(o->f)){
+		fprintf(stderr, "error: could not write output\n");
+		return 0;
+	}
+	return 1;
+}
@@ -1,298 +1,929 @@
-/*
- * Author: Joslyn Renfrey
- * Date: 13/01/2023
- */
-
-#include "circuitsim.h"
-#include <stdio.h>
-#include <string.h>
-#include <math.h>
-#include<stdlib.h>
-
-static int isendline(int c){ return (c == '\n') || (c == '\r') || (c == '\v'); }
-static int isblank(int c){ return (c == ' ') || (c == '\t'); }
-static int isnonblank(int c){ return !isendline(c) && !isblank(c) && c >= 0; }
-
-static int getWord(FILE *f, char *dest){
-	int c, i;
-	// skip blank space, but not line end
-	while(isblank(c = fgetc(f)));
-	if(c < 0){ return 0; }
-	ungetc(c, f);
-	// if we could not get any more words for this line
-	if(isendline(c)){ return 0; }
-	for(i = 0; isnonblank(c = fgetc(f)); i += (i <= max_name_len)? 1 : 0){
-		dest[i] = c;
-	}
-	if(c >= 0){ ungetc(c, f); }
-	dest[i] = '\0';
-	return 1;
-}
-
-static double getDouble(FILE *f){
-	char buffer[max_name_len + 1];
-	if(!getWord(f, buffer)){ return NAN; }
-	char *endptr = NULL;
-	double d = strtod(buffer, &endptr);
-	if(endptr == buffer){ return NAN; }
-	switch(*endptr){
-		case 'T': d *=  1e12 ; break;
-		case 'G': d *=  1e9  ; break;
-		case 'M': d *=  1e6  ; break;
-		case 'k': d *=  1e3  ; break;
-		case 'm': d *=  1e-3 ; break;
-		case 'u': d *=  1e-6 ; break;
-		case 'n': d *=  1e-9 ; break;
-		case 'p': d *=  1e-12; break;
-	}
-	return d;
-}
-
-// finishes a line regardless of if there are any words remaining
-// returns true if there are remaining lines
-static uint8_t getNextLine(FILE *f){
-	int c1;
-	while(!isendline(c1 = fgetc(f))){
-		if(c1 < 0){ return 0; }
-	}
-	//check next character...
-	int c2 = fgetc(f);
-	// EOF: no more lines
-	if(c2 < 0){
-		return 0;
-	}
-	// non-endline: more line(s)
-	else if(!isendline(c2)){
-		ungetc(c2, f);
-		return 1;
-	}
-	// unequal line-enders: a line ending pair
-	// peek ahead to see if EOF and hence, whether there is a line ahead
-	else if(c1 != c2){
-		c2 = fgetc(f);
-		ungetc(c2, f);
-		return c2 >= 0;
-	}
-	// equal line-enders: empty line ahead
-	else {
-		ungetc(c2, f);
-		return 1;
-	}
-}
-
-static component_t *componentByName(const char *s, component_t *c, int n){
-	for(int i = 0; i < n; i++){
-		if(strcmp(s, c[i].name) == 0){ return c + i; }
-	}
-	return NULL;
-}
-
-static node_t *nodeByName(const char *s, node_t *c, int n){
-	for(int i = 0; i < n; i++){
-		if(strcmp(s, c[i].name) == 0){ return c + i; }
-	}
-	return NULL;
-}
-
-static int nodeIndexByName(const char *s, node_t *c, int n){
-	for(int i = 0; i < n; i++){
-		if(strcmp(s, c[i].name) == 0){ return i; }
-	}
-	return -1;
-}
-
-#define COMPONENT_EXTERN( n ) \
-	extern const int n##_terminals_count; \
-	extern const int n##_parameters_count; \
-	extern void n##_currentCurve(const double *parameters, const double *v, double timestep, double *i); \
-	extern void n##_jacobian(const double *parameters, const double *v, double timestep, double *j); \
-	extern void n##_updateState(double *parameters, const double *v, double timestep, const double *i);
-COMPONENT_LIST(COMPONENT_EXTERN)
-
-int parseFile(FILE *f, sim_t *s){
-	#define COMPONENT_PROTOTYPE( n ) { \
-		.name = #n, \
-		.terminals_count = n##_terminals_count, \
-		.parameters_count = n##_parameters_count, \
-		.currentCurve = &n##_currentCurve, \
-		.jacobian = &n##_jacobian, \
-		.updateState = &n##_updateState \
-	},
-	component_t component_prototypes[] = {COMPONENT_LIST(COMPONENT_PROTOTYPE) {.name = ""}};
-
-	s->n_count = 0; s->c_count = 0;
-	int n_space = 0, c_space = 0;
-
-	s->errorsq = default_errorsq;
-	s->convrate = default_convrate;
-	s->maxiter = default_maxiter;
-	
-	#define ERROR(condition, ...) \
-	if(condition){ \
-		fprintf(stderr, "error: line %i: ", line_num); \
-		fprintf(stderr, __VA_ARGS__); \
-		fprintf(stderr, "\r\n"); \
-		return 0; \
-	}
-
-	// we will perform 3 passes
-	long f_start = ftell(f);
-	
-	char word[max_name_len + 1];
-	int line_num = 0;
-	// 1st pass: determine an upper bound on the space we need to store components and nodes
-	do {
-		line_num++;
-		// if line is empty, skip
-		if(!getWord(f, word)){ continue; }
-		else if (word[0] == '#' || word[0] == '/'){ continue; }
-		
-		// count node space
-		else if(strcmp(word, "nodes") == 0){
-			while(getWord(f, word)){ n_space++; }
-		}
-		// count component space
-		else {
-			c_space++;
-		}
-	}while(getNextLine(f));
-	
-	s->c = malloc(sizeof(component_t)*c_space);
-	s->n = malloc(sizeof(node_t)*n_space);
-	memset(s->c, 0, sizeof(component_t)*c_space);
-	memset(s->n, 0, sizeof(node_t)*n_space);
-	
-	// 2nd pass: read all nodes, and set voltages and measure flags
-	// after this we want to sort them into variable and fixed nodes
-	fseek(f, f_start, SEEK_SET);
-	line_num = 0;
-	do {
-		line_num++;
-		// if line is empty, skip
-		if(!getWord(f, word)){ continue; }
-		else if (word[0] == '#' || word[0] == '/'){ continue; }
-				
-		// also handle the timestep and endtime settings
-		else if(strcmp(word, "timestep") == 0){
-			s->timestep = getDouble(f);
-			ERROR(isnan(s->timestep) || s->timestep <= 0, "timestep invalid");
-		}	
-		else if(strcmp(word, "endtime") == 0){
-			s->endtime = getDouble(f);
-			ERROR(isnan(s->endtime) || s->endtime <= 0, "endtime invalid");
-		}
-		else if(strcmp(word, "convrate") == 0){
-			s->convrate = getDouble(f)/100;
-			ERROR(isnan(s->convrate) || s->convrate <= 0, "convrate invalid");
-		}	
-		else if(strcmp(word, "errorsq") == 0){
-			s->errorsq = getDouble(f);
-			ERROR(isnan(s->errorsq) || s->errorsq <= 0, "errorsq invalid");
-		}
-		else if(strcmp(word, "maxiter") == 0){
-			double d = getDouble(f);
-			ERROR(isnan(d) || d <= 0, "maxiter invalid");
-			s->maxiter = d;
-		}
-		
-		// nodes: add nodes
-		else if(strcmp(word, "nodes") == 0){
-			while(getWord(f, word)){
-				strcpy((s->n + s->n_count)->name, word);
-				(s->n + s->n_count)->is_fixed = 0;
-				(s->n + s->n_count)->is_measured = 0;
-				(s->n_count)++;
-			}
-		}
-		
-		// set: make fixed nodes. list is pairs of node names and voltages
-		else if(strcmp(word, "set") == 0){
-			while(getWord(f, word)){
-				node_t *target = nodeByName(word, s->n, s->n_count);
-				ERROR(target == NULL, "unrecognised node \"%s\"", word);
-				target->is_fixed = 1;
-				target->fixed_voltage = getDouble(f);
-				ERROR(isnan(target->fixed_voltage), "invalid node voltage");
-			}
-		}
-	} while(getNextLine(f));
-	
-	// we want to sort the nodes into variable and fixed
-	// before we parse components so that the node indices
-	// are properly applied
-	int var_n_count = s->n_count;
-	for(int i = 0; i < var_n_count;){
-		if(!(s->n)[i].is_fixed){ i++; }
-		else {
-			node_t temp = (s->n)[i];
-			(s->n)[i] = (s->n)[var_n_count - 1];
-			(s->n)[var_n_count - 1] = temp;
-			var_n_count--;
-		}
-	}
-	
-	// third pass: read component related nodes, 
-	fseek(f, f_start, SEEK_SET);
-	line_num = 0;
-	do {
-		line_num++;
-		// if line is empty, skip
-		if(!getWord(f, word)){ continue; }
-		else if (word[0] == '#' || word[0] == '/'){ continue; }
-		
-		// nodes: ignore all commands related to nodes and time settings
-		else if(strcmp(word, "timestep") == 0){}
-		else if(strcmp(word, "endtime") == 0){}
-		else if(strcmp(word, "nodes") == 0){}
-		else if(strcmp(word, "set") == 0){}
-		else if(strcmp(word, "convrate") == 0){}
-		else if(strcmp(word, "errorsq") == 0){}
-		else if(strcmp(word, "maxiter") == 0){}
-		
-		// measure: enable the is_measured flag on selected nodes or components
-		else if(strcmp(word, "measure") == 0){
-			while(getWord(f, word)){
-				node_t *tn; component_t *tc;
-				if((tn = nodeByName(word, s->n, s->n_count)) != NULL){
-					tn->is_measured = 1;
-				}
-				else if((tc = componentByName(word, s->c, s->c_count)) != NULL){	
-					tc->is_measured = 1;
-				}
-				else { ERROR(1, "unrecognised node or component \"%s\"", word); }
-			}
-		}
-
-		// otherwise assume first word is a component type
-		else {
-			// search through list of prototypes...
-			component_t *t = component_prototypes;
-			while(t->name[0] != '\0'){
-				if(strcmp(t->name, word) == 0){ break; } t++;
-			}
-			ERROR(t->name[0] == '\0', "unrecognised component type \"%s\"", word);
-			
-			memcpy(s->c + s->c_count, t, sizeof(component_t));
-			t = s->c + s->c_count; (s->c_count)++;
-			t->is_measured = 0;
-			
-			// make sure we get the components name...
-			ERROR(!getWord(f, word), "expected component name");
-			strcpy(t->name, word);
-			
-			// match terminal node names to indices
-			for(int i = 0; i < t->terminals_count; i++){
-				ERROR(!getWord(f, word), "expected terminal node");
-				t->terminals[i] = nodeIndexByName(word, s->n, s->n_count);
-				ERROR(t->terminals[i] < 0, "unrecognised node \"%s\"", word);
-			}
-			
-			// read parameters
-			for(int i = 0; i < t->parameters_count; i++){
-				t->parameters[i] = getDouble(f);
-				ERROR(isnan(t->parameters[i]), "expected numerical parameter");
-			}
-		}
-	} while(getNextLine(f));
-	return 1;
-}
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include "circuitsim.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include<stdlib.h>
+
+// the whole file is read in to memory, and read through once
+typedef struct {
+	const char *p, *end;
+} reader_t;
+
+static int isendline(int c){ return (c == '\n') || (c == '\r') || (c == '\v'); }
+static int isblank(int c){ return (c == ' ') || (c == '\t'); }
+static int isnonblank(int c){ return !isendline(c) && !isblank(c); }
+
+// get the next word on this line, which is cut short at max_name_len
+static int getWord(reader_t *r, char *dest){
+	// skip blank space, but not line end
+	while(r->p < r->end && isblank(*r->p)){ r->p++; }
+	// if we could not get any more words for this line
+	if(r->p == r->end || isendline(*r->p)){ return 0; }
+	int i = 0;
+	for(; r->p < r->end && isnonblank(*r->p); r->p++){
+		if(i < max_name_len){ dest[i++] = *r->p; }
+	}
+	dest[i] = '\0';
+	return 1;
+}
+
+static double getDouble(reader_t *r){
+	char buffer[max_name_len + 1];
+	if(!getWord(r, buffer)){ return NAN; }
+	char *endptr = NULL;
+	double d = strtod(buffer, &endptr);
+	if(endptr == buffer){ return NAN; }
+	switch(*endptr){
+		case 'T': d *=  1e12 ; break;
+		case 'G': d *=  1e9  ; break;
+		case 'M': d *=  1e6  ; break;
+		case 'k': d *=  1e3  ; break;
+		case 'm': d *=  1e-3 ; break;
+		case 'u': d *=  1e-6 ; break;
+		case 'n': d *=  1e-9 ; break;
+		case 'p': d *=  1e-12; break;
+	}
+	return d;
+}
+
+// finishes a line regardless of if there are any words remaining
+// returns true if there are remaining lines
+static uint8_t getNextLine(reader_t *r){
+	while(r->p < r->end && !isendline(*r->p)){ r->p++; }
+	if(r->p == r->end){ return 0; }
+	char c1 = *r->p++;
+	// unequal line-enders are a line ending pair
+	if(r->p < r->end && isendline(*r->p) && *r->p != c1){ r->p++; }
+	return r->p < r->end;
+}
+
+// read all of f, in large blocks
+static char *readFile(FILE *f, size_t *len){
+	size_t space = 1 << 16, n;
+	char *text = malloc(space);
+	*len = 0;
+	while((n = fread(text + *len, 1, space - *len, f)) > 0){
+		*len += n;
+		if(*len == space){
+			space *= 2;
+			text = realloc(text, space);
+		}
+	}
+	return text;
+}
+
+static uint32_t hashName(const char *name){
+	uint32_t h = 2166136261u;
+	for(; *name; name++){ h = (h ^ (uint8_t) *name)*16777619u; }
+	return h;
+}
+
+static int *findSlot(const name_table_t *t, const char *base, size_t stride, const char *name){
+	uint32_t mask = t->space - 1;
+	for(uint32_t i = hashName(name) & mask;; i = (i + 1) & mask){
+		if(t->slots[i] < 0 || strcmp(base + t->slots[i]*stride, name) == 0){ return t->slots + i; }
+	}
+}
+
+int tableFind(const name_table_t *t, const char *base, size_t stride, const char *name){
+	if(t->space == 0){ return -1; }
+	return *findSlot(t, base, stride, name);
+}
+
+// the first of any duplicate names is the one that is found, as it always was
+void tableInsert(name_table_t *t, const char *base, size_t stride, int index){
+	if(2*(t->count + 1) > t->space){
+		name_table_t bigger = {NULL, (t->space > 0)? 2*t->space : 1024, t->count};
+		bigger.slots = malloc(sizeof(int)*bigger.space);
+		for(int i = 0; i < bigger.space; i++){ bigger.slots[i] = -1; }
+		for(int i = 0; i < t->space; i++){
+			if(t->slots[i] >= 0){ *findSlot(&bigger, base, stride, base + t->slots[i]*stride) = t->slots[i]; }
+		}
+		free(t->slots);
+		*t = bigger;
+	}
+	int *slot = findSlot(t, base, stride, base + index*stride);
+	if(*slot < 0){ *slot = index; t->count++; }
+}
+
+#define nodeNames ((const char *) p->s->n_info + offsetof(info_t, name)), sizeof(info_t)
+#define componentNames ((const char *) p->s->c_info + offsetof(info_t, name)), sizeof(info_t)
+#define nodeFind(key) tableFind(&p->node_names, nodeNames, key)
+#define componentFind(key) tableFind(&p->component_names, componentNames, key)
+
+// a name that could not be looked up when it was read, because it
+// might be declared further on. they are all resolved at the end
+typedef struct {
+	char name[max_name_len + 1];
+	int line, index, slot;
+	double value;
+} reference_t;
+
+typedef struct {
+	reference_t *refs;
+	int count, space;
+} reference_list_t;
+
+static reference_t *addReference(reference_list_t *l, const char *name, int line){
+	if(l->count == l->space){
+		l->space = 2*l->space + 16;
+		l->refs = realloc(l->refs, sizeof(reference_t)*l->space);
+	}
+	reference_t *ref = l->refs + l->count++;
+	strcpy(ref->name, name);
+	ref->line = line;
+	return ref;
+}
+
+#define grow(array, count, space) \
+	if(count == space){ \
+		space = 2*space + 16; \
+		array = realloc(array, sizeof(*array)*space); \
+		memset(array + count, 0, sizeof(*array)*(space - count)); \
+	}
+
+// a subcircuit is kept as a list of elements, each a component or an instance
+// of an earlier subcircuit, which is copied out for every instance of it.
+// terminals are matched to the subcircuit's own names when it ends
+typedef struct {
+	char name[max_name_len + 1];
+	// index in to the subcircuit's names, or -1 for a global node
+	int local;
+} terminal_name_t;
+
+typedef struct {
+	char name[max_name_len + 1];
+	// index in to the component prototypes, or -1 for an instance of subckt
+	int type, subckt;
+	int terminals_count, first_terminal;
+	// the parameter block, which every instance shares unless the component has state
+	int block;
+	int line;
+} element_t;
+
+typedef struct {
+	char name[max_name_len + 1];
+	// the ports come first, followed by the internal nodes
+	char (*names)[max_name_len + 1];
+	int ports_count, names_count, names_space;
+	element_t *elements;
+	int elements_count, elements_space;
+	terminal_name_t *terminals;
+	int terminals_count, terminals_space;
+} subckt_t;
+
+#define COMPONENT_EXTERN( n ) extern const component_ops_t n##_ops;
+COMPONENT_LIST(COMPONENT_EXTERN)
+
+#define COMPONENT_OPS( n ) &n##_ops,
+#define COMPONENT_NAME( n ) #n,
+static const component_ops_t *const prototypes[] = {COMPONENT_LIST(COMPONENT_OPS)};
+static const char *const prototype_names[] = {COMPONENT_LIST(COMPONENT_NAME) ""};
+
+// a circuit being read from text, or built through the library, which is
+// turned in to the simulation by parseFinish
+struct parser {
+	sim_t *s;
+	name_table_t node_names, component_names;
+	reference_list_t terminal_refs, set_refs, measure_refs, variation_refs;
+	// the nodes and components grow here, and are moved
+	// in to the simulation's arena once they are all read
+	int n_space, c_space, v_space, n_info_space, c_info_space;
+	
+	// parameter blocks, and the block of each component. they only become
+	// pointers at the end, once the blocks have stopped moving
+	double (*blocks)[max_params];
+	int blocks_count, blocks_space;
+	int *block_of, block_of_space;
+	
+	subckt_t *subckts;
+	int subckts_count, subckts_space;
+	// the subcircuit being defined, between subckt and ends
+	subckt_t *open;
+	// the size of the table model, which can be given before or after it
+	int table_points;
+	// the limiting mode, or -1 if it was not given
+	int limiting;
+};
+
+// line_num is 0 for a circuit built through the library, which has no lines
+#define ERROR(condition, ...) \
+if(condition){ \
+	if(line_num > 0){ fprintf(stderr, "error: line %i: ", line_num); } \
+	else { fprintf(stderr, "error: "); } \
+	fprintf(stderr, __VA_ARGS__); \
+	fprintf(stderr, "\r\n"); \
+	return 0; \
+}
+
+static int findPrototype(const char *name){
+	for(int i = 0; prototype_names[i][0] != '\0'; i++){
+		if(strcmp(prototype_names[i], name) == 0){ return i; }
+	}
+	return -1;
+}
+
+static int findSubckt(parser_t *p, const char *name){
+	for(int i = 0; i < p->subckts_count; i++){
+		if(strcmp(p->subckts[i].name, name) == 0){ return i; }
+	}
+	return -1;
+}
+
+static int newBlock(parser_t *p){
+	grow(p->blocks, p->blocks_count, p->blocks_space);
+	return p->blocks_count++;
+}
+
+static int readParameters(reader_t *r, double *parameters, int count){
+	for(int i = 0; i < count; i++){
+		parameters[i] = getDouble(r);
+		if(isnan(parameters[i])){ return 0; }
+	}
+	return 1;
+}
+
+static void addNode(parser_t *p, const char *name){
+	sim_t *s = p->s;
+	grow(s->n, s->n_count, p->n_space);
+	grow(s->n_info, s->n_count, p->n_info_space);
+	strcpy(s->n_info[s->n_count].name, name);
+	s->n_info[s->n_count].is_measured = 0;
+	s->n[s->n_count].is_fixed = 0;
+	tableInsert(&p->node_names, nodeNames, s->n_count);
+	s->n_count++;
+}
+
+// a component of type t, using the given parameter block
+static int addComponent(parser_t *p, const component_ops_t *t, const char *name, int block){
+	sim_t *s = p->s;
+	grow(s->c, s->c_count, p->c_space);
+	grow(s->c_info, s->c_count, p->c_info_space);
+	grow(p->block_of, s->c_count, p->block_of_space);
+	component_t *c = s->c + s->c_count;
+	memset(c, 0, sizeof(component_t));
+	c->ops = t;
+	c->terminals_count = t->terminals_count;
+	c->linearity = t->linearity;
+	strcpy(s->c_info[s->c_count].name, name);
+	s->c_info[s->c_count].is_measured = 0;
+	p->block_of[s->c_count] = block;
+	tableInsert(&p->component_names, componentNames, s->c_count);
+	return s->c_count++;
+}
+
+// nodes that are not declared yet are looked up at the end
+static void setTerminal(parser_t *p, int component, int slot, const char *name, int line){
+	int index = nodeFind(name);
+	p->s->c[component].terminals[slot] = index;
+	if(index < 0){
+		reference_t *ref = addReference(&p->terminal_refs, name, line);
+		ref->index = component;
+		ref->slot = slot;
+	}
+}
+
+// hierarchical names are the instance name, a dot, then the local name
+static int joinName(char *dest, const char *prefix, const char *name){
+	return snprintf(dest, max_name_len + 1, "%s.%s", prefix, name) <= max_name_len;
+}
+
+// read a component or instance line of a subcircuit definition
+static int addElement(parser_t *p, reader_t *r, const char *type, int line_num){
+	subckt_t *sc = p->open;
+	grow(sc->elements, sc->elements_count, sc->elements_space);
+	element_t *e = sc->elements + sc->elements_count;
+	e->type = findPrototype(type);
+	e->subckt = (e->type < 0)? findSubckt(p, type) : -1;
+	ERROR(e->type < 0 && e->subckt < 0, "unrecognised component type \"%s\"", type);
+	ERROR(!getWord(r, e->name), "expected component name");
+	e->line = line_num;
+	
+	e->terminals_count = (e->type >= 0)? prototypes[e->type]->terminals_count : p->subckts[e->subckt].ports_count;
+	e->first_terminal = sc->terminals_count;
+	for(int i = 0; i < e->terminals_count; i++){
+		grow(sc->terminals, sc->terminals_count, sc->terminals_space);
+		ERROR(!getWord(r, sc->terminals[sc->terminals_count].name), "expected terminal node");
+		sc->terminals_count++;
+	}
+	if(e->type >= 0){
+		e->block = newBlock(p);
+		ERROR(!readParameters(r, p->blocks[e->block], prototypes[e->type]->parameters_count), "expected numerical parameter");
+	}
+	sc->elements_count++;
+	return 1;
+}
+
+// copy the elements of a subcircuit in to the circuit, with their names and
+// the internal nodes prefixed by the instance name. nodes holds the names of
+// the nodes the ports connect to, with space for the internal nodes after them
+static int instantiate(parser_t *p, int subckt, const char *prefix, char (*nodes)[max_name_len + 1], int line){
+	const subckt_t *sc = p->subckts + subckt;
+	int line_num = line;
+	for(int i = sc->ports_count; i < sc->names_count; i++){
+		ERROR(!joinName(nodes[i], prefix, sc->names[i]), "name \"%s.%s\" is too long", prefix, sc->names[i]);
+		addNode(p, nodes[i]);
+	}
+	
+	char name[max_name_len + 1];
+	for(int k = 0; k < sc->elements_count; k++){
+		const element_t *e = sc->elements + k;
+		const terminal_name_t *terminals = sc->terminals + e->first_terminal;
+		ERROR(!joinName(name, prefix, e->name), "name \"%s.%s\" is too long", prefix, e->name);
+		if(e->type >= 0){
+			const component_ops_t *t = prototypes[e->type];
+			// reactive components keep their state with their parameters, so they can not share them
+			int block = e->block;
+			if(t->linearity == linear_reactive){
+				block = newBlock(p);
+				memcpy(p->blocks[block], p->blocks[e->block], sizeof(p->blocks[0]));
+			}
+			int index = addComponent(p, t, name, block);
+			for(int i = 0; i < e->terminals_count; i++){
+				int local = terminals[i].local;
+				setTerminal(p, index, i, (local >= 0)? nodes[local] : terminals[i].name, (local >= 0)? line : e->line);
+			}
+		} else {
+			const subckt_t *inner = p->subckts + e->subckt;
+			char (*inner_nodes)[max_name_len + 1] = malloc(sizeof(*inner_nodes)*(inner->names_count + 1));
+			for(int i = 0; i < e->terminals_count; i++){
+				int local = terminals[i].local;
+				strcpy(inner_nodes[i], (local >= 0)? nodes[local] : terminals[i].name);
+			}
+			int ok = instantiate(p, e->subckt, name, inner_nodes, e->line);
+			free(inner_nodes);
+			if(!ok){ return 0; }
+		}
+	}
+	return 1;
+}
+
+// start reading or building a circuit in to s, with every setting at its
+// default. names are looked up through hash tables, and any that are used
+// before they are declared are kept for parseFinish, so text is only read once
+parser_t *parseStart(sim_t *s){
+	parser_t *p = calloc(1, sizeof(parser_t));
+	p->s = s;
+	p->table_points = default_table_points;
+	p->limiting = -1;
+	
+	s->n_count = 0; s->c_count = 0;
+	s->c = NULL; s->n = NULL;
+	s->c_info = NULL; s->n_info = NULL;
+	s->params = NULL; s->params_count = 0;
+	s->jac_index = NULL;
+	s->arena.blocks = NULL;
+
+	s->errorsq = default_errorsq;
+	s->convrate = default_convrate;
+	s->maxiter = default_maxiter;
+	s->solver = solver_dense;
+	s->reuse_pivots = 0;
+	s->pivot_tol = default_pivot_tol;
+	s->chord = 0;
+	s->chord_tol = 0;
+	s->adaptive = 0;
+	s->minstep = 0;
+	s->maxstep = 0;
+	s->tol = (tolerance_t) {default_reltol, default_vntol, default_abstol};
+	s->format = format_csv;
+	s->single = 0;
+	s->block_rows = 0;
+	s->precision = default_precision;
+	s->variations = NULL;
+	s->variations_count = 0;
+	s->runs = 1;
+	s->threads = 1;
+	s->eval_threads = 1;
+	s->eval_pool = NULL;
+	s->partitions = 0;
+	s->bbd = NULL;
+	s->checkpoint_interval = 0;
+	s->checkpoint_file = NULL;
+	s->resume = 0;
+	s->checkpoint = NULL;
+	s->seed = default_seed;
+	s->batch = batch_files;
+	s->quiet = 0;
+	s->groups = NULL;
+	s->groups_count = 0;
+	s->currents = NULL;
+	s->table_points = 0;
+	s->table = NULL;
+	s->records = NULL;
+	s->records_rows = 0;
+	s->op = 0;
+	s->limiting = 0;
+	s->damping = damping_fixed;
+	s->v_last = s->v_last_saved = NULL;
+	s->v_base = s->newton_step = NULL;
+	s->evaluated = 0;
+	s->predictor = 0;
+	s->history = s->prediction = NULL;
+	s->e_trial = s->jac_trial = s->currents_saved = s->v_last_trial = NULL;
+	s->factor_single = 0;
+	s->refine_b = s->refine_r = NULL;
+	s->gmin = default_gmin;
+	s->v_ramp = NULL;
+	memset(&s->stats, 0, sizeof(stats_t));
+	s->profiling = 0;
+	memset(&s->profile, 0, sizeof(profile_t));
+	return p;
+}
+
+// read the text of a .conf file in to p, which does not need to end in a newline
+int parseLines(parser_t *p, const char *text, size_t len){
+	sim_t *s = p->s;
+	reader_t reader = {text, text + len}, *r = &reader;
+	char word[max_name_len + 1];
+	int line_num = 0;
+	do {
+		line_num++;
+		// if line is empty, skip
+		if(!getWord(r, word)){ continue; }
+		else if (word[0] == '#' || word[0] == '/'){ continue; }
+				
+		// also handle the timestep and endtime settings
+		else if(strcmp(word, "timestep") == 0){
+			s->timestep = getDouble(r);
+			ERROR(isnan(s->timestep) || s->timestep <= 0, "timestep invalid");
+		}	
+		else if(strcmp(word, "endtime") == 0){
+			s->endtime = getDouble(r);
+			ERROR(isnan(s->endtime) || s->endtime <= 0, "endtime invalid");
+		}
+		else if(strcmp(word, "convrate") == 0){
+			s->convrate = getDouble(r)/100;
+			ERROR(isnan(s->convrate) || s->convrate <= 0, "convrate invalid");
+		}	
+		else if(strcmp(word, "errorsq") == 0){
+			s->errorsq = getDouble(r);
+			ERROR(isnan(s->errorsq) || s->errorsq <= 0, "errorsq invalid");
+		}
+		else if(strcmp(word, "maxiter") == 0){
+			double d = getDouble(r);
+			ERROR(isnan(d) || d <= 0, "maxiter invalid");
+			s->maxiter = d;
+		}
+		else if(strcmp(word, "solver") == 0){
+			ERROR(!getWord(r, word), "expected solver type");
+			if(strcmp(word, "dense") == 0){ s->solver = solver_dense; }
+			else if(strcmp(word, "sparse") == 0){ s->solver = solver_sparse; }
+			else { ERROR(1, "unrecognised solver \"%s\"", word); }
+		}
+		else if(strcmp(word, "pivoting") == 0){
+			ERROR(!getWord(r, word), "expected pivoting mode");
+			if(strcmp(word, "full") == 0){ s->reuse_pivots = 0; }
+			else if(strcmp(word, "reuse") == 0){ s->reuse_pivots = 1; }
+			else { ERROR(1, "unrecognised pivoting mode \"%s\"", word); }
+		}
+		else if(strcmp(word, "factor") == 0){
+			ERROR(!getWord(r, word), "expected factor precision");
+			if(strcmp(word, "double") == 0){ s->factor_single = 0; }
+			else if(strcmp(word, "single") == 0){ s->factor_single = 1; }
+			else { ERROR(1, "unrecognised factor precision \"%s\"", word); }
+		}
+		else if(strcmp(word, "newton") == 0){
+			ERROR(!getWord(r, word), "expected newton mode");
+			if(strcmp(word, "full") == 0){ s->chord = 0; }
+			else if(strcmp(word, "chord") == 0){ s->chord = 1; }
+			else { ERROR(1, "unrecognised newton mode \"%s\"", word); }
+		}
+		else if(strcmp(word, "limiting") == 0){
+			ERROR(!getWord(r, word), "expected limiting mode");
+			if(strcmp(word, "none") == 0){ p->limiting = 0; }
+			else if(strcmp(word, "junction") == 0){ p->limiting = 1; }
+			else { ERROR(1, "unrecognised limiting mode \"%s\"", word); }
+		}
+		else if(strcmp(word, "damping") == 0){
+			ERROR(!getWord(r, word), "expected damping mode");
+			if(strcmp(word, "fixed") == 0){ s->damping = damping_fixed; }
+			else if(strcmp(word, "linesearch") == 0){ s->damping = damping_linesearch; }
+			else { ERROR(1, "unrecognised damping mode \"%s\"", word); }
+		}
+		else if(strcmp(word, "predictor") == 0){
+			double d = getDouble(r);
+			ERROR(isnan(d) || d < 0 || d > max_predictor, "predictor order invalid");
+			s->predictor = d;
+		}
+		else if(strcmp(word, "chordtol") == 0){
+			s->chord_tol = getDouble(r);
+			ERROR(isnan(s->chord_tol) || s->chord_tol < 0, "chordtol invalid");
+		}
+		else if(strcmp(word, "adaptive") == 0){
+			s->adaptive = 1;
+		}
+		else if(strcmp(word, "minstep") == 0){
+			s->minstep = getDouble(r);
+			ERROR(isnan(s->minstep) || s->minstep <= 0, "minstep invalid");
+		}
+		else if(strcmp(word, "maxstep") == 0){
+			s->maxstep = getDouble(r);
+			ERROR(isnan(s->maxstep) || s->maxstep <= 0, "maxstep invalid");
+		}
+		else if(strcmp(word, "reltol") == 0){
+			s->tol.reltol = getDouble(r);
+			ERROR(isnan(s->tol.reltol) || s->tol.reltol <= 0, "reltol invalid");
+		}
+		else if(strcmp(word, "vntol") == 0){
+			s->tol.vntol = getDouble(r);
+			ERROR(isnan(s->tol.vntol) || s->tol.vntol <= 0, "vntol invalid");
+		}
+		else if(strcmp(word, "abstol") == 0){
+			s->tol.abstol = getDouble(r);
+			ERROR(isnan(s->tol.abstol) || s->tol.abstol <= 0, "abstol invalid");
+		}
+		else if(strcmp(word, "partitions") == 0){
+			double d = getDouble(r);
+			ERROR(isnan(d) || d < 1, "partitions invalid");
+			s->partitions = d;
+		}
+		else if(strcmp(word, "pivottol") == 0){
+			s->pivot_tol = getDouble(r);
+			ERROR(isnan(s->pivot_tol) || s->pivot_tol < 0 || s->pivot_tol > 1, "pivottol invalid");
+		}
+		else if(strcmp(word, "model") == 0){
+			ERROR(!getWord(r, word), "expected device model");
+			if(strcmp(word, "exact") == 0){ s->table_points = 0; }
+			else if(strcmp(word, "table") == 0){ s->table_points = -1; }
+			else { ERROR(1, "unrecognised device model \"%s\"", word); }
+		}
+		else if(strcmp(word, "tablepoints") == 0){
+			double d = getDouble(r);
+			ERROR(isnan(d) || d < 2, "tablepoints invalid");
+			p->table_points = d;
+		}
+		else if(strcmp(word, "op") == 0){
+			s->op = 1;
+		}
+		else if(strcmp(word, "gmin") == 0){
+			s->gmin = getDouble(r);
+			ERROR(isnan(s->gmin) || s->gmin < 0, "gmin invalid");
+		}
+		else if(strcmp(word, "runs") == 0){
+			double d = getDouble(r);
+			ERROR(isnan(d) || d < 1, "runs invalid");
+			s->runs = d;
+		}
+		else if(strcmp(word, "seed") == 0){
+			double d = getDouble(r);
+			ERROR(isnan(d) || d < 0, "seed invalid");
+			s->seed = d;
+		}
+		else if(strcmp(word, "batch") == 0){
+			ERROR(!getWord(r, word), "expected batch output");
+			if(strcmp(word, "files") == 0){ s->batch = batch_files; }
+			else if(strcmp(word, "stats") == 0){ s->batch = batch_stats; }
+			else { ERROR(1, "unrecognised batch output \"%s\"", word); }
+		}
+		
+		// nodes: add nodes, or the internal nodes of a subcircuit
+		else if(strcmp(word, "nodes") == 0){
+			while(getWord(r, word)){
+				if(p->open == NULL){ addNode(p, word); continue; }
+				grow(p->open->names, p->open->names_count, p->open->names_space);
+				strcpy(p->open->names[p->open->names_count++], word);
+			}
+		}
+		
+		// subckt: start a subcircuit definition, with its name and ports
+		else if(strcmp(word, "subckt") == 0){
+			ERROR(p->open != NULL, "subcircuits can not be defined inside subcircuits");
+			grow(p->subckts, p->subckts_count, p->subckts_space);
+			subckt_t *sc = p->open = p->subckts + p->subckts_count;
+			ERROR(!getWord(r, sc->name), "expected subcircuit name");
+			ERROR(findPrototype(sc->name) >= 0 || findSubckt(p, sc->name) >= 0, "\"%s\" is already defined", sc->name);
+			while(getWord(r, word)){
+				grow(sc->names, sc->names_count, sc->names_space);
+				strcpy(sc->names[sc->names_count++], word);
+			}
+			sc->ports_count = sc->names_count;
+		}
+		
+		// ends: finish the definition, now its internal nodes are all known
+		else if(strcmp(word, "ends") == 0){
+			subckt_t *sc = p->open;
+			ERROR(sc == NULL, "ends without subckt");
+			name_table_t local = {0};
+			for(int i = 0; i < sc->names_count; i++){
+				tableInsert(&local, (const char *) sc->names, sizeof(*sc->names), i);
+			}
+			for(int i = 0; i < sc->terminals_count; i++){
+				sc->terminals[i].local = tableFind(&local, (const char *) sc->names, sizeof(*sc->names), sc->terminals[i].name);
+			}
+			free(local.slots);
+			p->subckts_count++;
+			p->open = NULL;
+		}
+		
+		// anything else inside a subcircuit is one of its elements
+		else if(p->open != NULL){
+			if(!addElement(p, r, word, line_num)){ return 0; }
+		}
+		
+		// set: make fixed nodes. list is pairs of node names and voltages
+		else if(strcmp(word, "set") == 0){
+			while(getWord(r, word)){
+				double voltage = getDouble(r);
+				ERROR(isnan(voltage), "invalid node voltage");
+				int index = nodeFind(word);
+				if(index >= 0){
+					s->n[index].is_fixed = 1;
+					s->n[index].fixed_voltage = voltage;
+				} else {
+					addReference(&p->set_refs, word, line_num)->value = voltage;
+				}
+			}
+		}
+		
+		// sweep or vary: change a component parameter between batch runs
+		else if(strcmp(word, "sweep") == 0 || strcmp(word, "vary") == 0){
+			grow(s->variations, s->variations_count, p->v_space);
+			variation_t *var = s->variations + s->variations_count;
+			int sweep = (word[0] == 's');
+			// the component and its parameter are checked at the end
+			ERROR(!getWord(r, word), "expected component name");
+			addReference(&p->variation_refs, word, line_num)->index = s->variations_count;
+			double d = getDouble(r);
+			ERROR(isnan(d) || d < 1, "invalid parameter number");
+			var->parameter = d - 1;
+			
+			if(sweep){
+				var->type = vary_linear;
+				var->from = getDouble(r);
+				var->to = getDouble(r);
+				d = getDouble(r);
+				ERROR(isnan(var->from) || isnan(var->to), "expected sweep range");
+				ERROR(isnan(d) || d < 1, "invalid number of sweep points");
+				var->points = d;
+				if(getWord(r, word)){
+					ERROR(strcmp(word, "log") != 0 && strcmp(word, "linear") != 0, "unrecognised sweep \"%s\"", word);
+					if(word[1] == 'o'){ var->type = vary_log; }
+				}
+				ERROR(var->type == vary_log && (var->from <= 0 || var->to <= 0), "log sweep must be positive");
+			} else {
+				ERROR(!getWord(r, word), "expected distribution");
+				if(strcmp(word, "uniform") == 0){ var->type = vary_uniform; }
+				else if(strcmp(word, "gauss") == 0){ var->type = vary_gauss; }
+				else { ERROR(1, "unrecognised distribution \"%s\"", word); }
+				// the spread is a percentage, like convrate
+				var->spread = getDouble(r)/100;
+				ERROR(isnan(var->spread) || var->spread < 0, "spread invalid");
+			}
+			s->variations_count++;
+		}
+		
+		// measure: enable the is_measured flag on selected nodes or components
+		else if(strcmp(word, "measure") == 0){
+			while(getWord(r, word)){
+				addReference(&p->measure_refs, word, line_num);
+			}
+		}
+
+		// otherwise assume first word is a component type, or a subcircuit
+		else {
+			int type = findPrototype(word), subckt = findSubckt(p, word);
+			ERROR(type < 0 && subckt < 0, "unrecognised component type \"%s\"", word);
+			char name[max_name_len + 1];
+			ERROR(!getWord(r, name), "expected component name");
+			
+			if(type >= 0){
+				const component_ops_t *t = prototypes[type];
+				int block = newBlock(p);
+				int index = addComponent(p, t, name, block);
+				// match terminal node names to indices
+				for(int i = 0; i < t->terminals_count; i++){
+					ERROR(!getWord(r, word), "expected terminal node");
+					setTerminal(p, index, i, word, line_num);
+				}
+				ERROR(!readParameters(r, p->blocks[block], t->parameters_count), "expected numerical parameter");
+			} else {
+				// an instance: the nodes its ports connect to, then its elements
+				const subckt_t *sc = p->subckts + subckt;
+				char (*nodes)[max_name_len + 1] = malloc(sizeof(*nodes)*(sc->names_count + 1));
+				for(int i = 0; i < sc->ports_count; i++){
+					ERROR(!getWord(r, nodes[i]), "expected terminal node");
+				}
+				int ok = instantiate(p, subckt, name, nodes, line_num);
+				free(nodes);
+				if(!ok){ return 0; }
+			}
+		}
+	} while(getNextLine(r));
+	ERROR(p->open != NULL, "subcircuit \"%s\" has no ends", p->open->name);
+	return 1;
+}
+
+// the rest build a circuit without text, for the library. they check what
+// would have been checked as the text was read, and also refuse names that
+// are too long or used twice, which a line of text can not show
+int parseNode(parser_t *p, const char *name){
+	int line_num = 0;
+	ERROR(strlen(name) > max_name_len, "node name \"%s\" is too long", name);
+	ERROR(nodeFind(name) >= 0, "node \"%s\" already exists", name);
+	addNode(p, name);
+	return 1;
+}
+
+// a component of a built in type, or an instance of a subcircuit defined in
+// text, which has no parameters. nodes can be added after they are used
+int parseComponent(parser_t *p, const char *type, const char *name, const char *const *nodes, const double *parameters){
+	int line_num = 0;
+	int t = findPrototype(type), subckt = (t < 0)? findSubckt(p, type) : -1;
+	ERROR(t < 0 && subckt < 0, "unrecognised component type \"%s\"", type);
+	ERROR(strlen(name) > max_name_len, "component name \"%s\" is too long", name);
+	int count = (t >= 0)? prototypes[t]->terminals_count : p->subckts[subckt].ports_count;
+	for(int i = 0; i < count; i++){
+		ERROR(strlen(nodes[i]) > max_name_len, "node name \"%s\" is too long", nodes[i]);
+	}
+	if(t >= 0){
+		const component_ops_t *c = prototypes[t];
+		ERROR(componentFind(name) >= 0, "component \"%s\" already exists", name);
+		int block = newBlock(p);
+		for(int i = 0; i < c->parameters_count; i++){ p->blocks[block][i] = parameters[i]; }
+		int index = addComponent(p, c, name, block);
+		for(int i = 0; i < count; i++){ setTerminal(p, index, i, nodes[i], 0); }
+		return 1;
+	}
+	const subckt_t *sc = p->subckts + subckt;
+	char (*names)[max_name_len + 1] = malloc(sizeof(*names)*(sc->names_count + 1));
+	for(int i = 0; i < count; i++){ strcpy(names[i], nodes[i]); }
+	int ok = instantiate(p, subckt, name, names, 0);
+	free(names);
+	return ok;
+}
+
+int parseFixed(parser_t *p, const char *name, double voltage){
+	int line_num = 0;
+	ERROR(strlen(name) > max_name_len, "node name \"%s\" is too long", name);
+	ERROR(isnan(voltage), "invalid node voltage");
+	int index = nodeFind(name);
+	if(index < 0){
+		addReference(&p->set_refs, name, 0)->value = voltage;
+		return 1;
+	}
+	p->s->n[index].is_fixed = 1;
+	p->s->n[index].fixed_voltage = voltage;
+	return 1;
+}
+
+// now every name is known, resolve the ones that were used too early
+static int resolveNames(parser_t *p){
+	sim_t *s = p->s;
+	int line_num = 0;
+	for(int i = 0; i < p->set_refs.count; i++){
+		reference_t *ref = p->set_refs.refs + i;
+		int index = nodeFind(ref->name);
+		line_num = ref->line;
+		ERROR(index < 0, "unrecognised node \"%s\"", ref->name);
+		s->n[index].is_fixed = 1;
+		s->n[index].fixed_voltage = ref->value;
+	}
+	for(int i = 0; i < p->terminal_refs.count; i++){
+		reference_t *ref = p->terminal_refs.refs + i;
+		int index = nodeFind(ref->name);
+		line_num = ref->line;
+		ERROR(index < 0, "unrecognised node \"%s\"", ref->name);
+		s->c[ref->index].terminals[ref->slot] = index;
+	}
+	for(int i = 0; i < p->measure_refs.count; i++){
+		reference_t *ref = p->measure_refs.refs + i;
+		int index;
+		line_num = ref->line;
+		if((index = nodeFind(ref->name)) >= 0){
+			s->n_info[index].is_measured = 1;
+		}
+		else if((index = componentFind(ref->name)) >= 0){
+			s->c_info[index].is_measured = 1;
+		}
+		else { ERROR(1, "unrecognised node or component \"%s\"", ref->name); }
+	}
+	for(int i = 0; i < p->variation_refs.count; i++){
+		reference_t *ref = p->variation_refs.refs + i;
+		variation_t *var = s->variations + ref->index;
+		int index = componentFind(ref->name);
+		line_num = ref->line;
+		ERROR(index < 0, "unrecognised component \"%s\"", ref->name);
+		var->component = index;
+		ERROR(var->parameter < 0 || var->parameter >= s->c[index].ops->parameters_count, "invalid parameter number");
+		// a varied parameter must not change the other instances of a subcircuit
+		int block = newBlock(p);
+		memcpy(p->blocks[block], p->blocks[p->block_of[index]], sizeof(p->blocks[0]));
+		p->block_of[index] = block;
+	}
+	return 1;
+}
+
+static void freeParser(parser_t *p){
+	free(p->terminal_refs.refs); free(p->set_refs.refs);
+	free(p->measure_refs.refs); free(p->variation_refs.refs);
+	free(p->node_names.slots); free(p->component_names.slots);
+	free(p->blocks);
+	free(p->block_of);
+	for(int i = 0; i < p->subckts_count; i++){
+		free(p->subckts[i].names);
+		free(p->subckts[i].elements);
+		free(p->subckts[i].terminals);
+	}
+	free(p->subckts);
+	free(p);
+}
+
+// give up on a circuit that has not been finished, along with the nodes and
+// components read so far. the variations stay with the simulation
+void parseFree(parser_t *p){
+	sim_t *s = p->s;
+	free(s->c); free(s->n); free(s->c_info); free(s->n_info);
+	s->c = NULL; s->n = NULL; s->c_info = NULL; s->n_info = NULL;
+	s->n_count = s->c_count = 0;
+	freeParser(p);
+}
+
+// turn what p has read in to the simulation, and free p. the nodes are
+// sorted, so a node's index is only known once this is done
+int parseFinish(parser_t *p){
+	sim_t *s = p->s;
+	if(!resolveNames(p)){
+		parseFree(p);
+		return 0;
+	}
+	
+	// the parameter blocks have stopped moving, so components can point in to them
+	s->params = arenaCopy(&s->arena, p->blocks, sizeof(p->blocks[0])*p->blocks_count);
+	s->params_count = p->blocks_count;
+	for(int i = 0; i < s->c_count; i++){
+		s->c[i].parameters = s->params + (size_t) p->block_of[i]*max_params;
+	}
+	// the table size can be given before or after the model
+	if(s->table_points < 0){ s->table_points = p->table_points; }
+	// the line search tries steps that have been limited, unless told not to
+	if(p->limiting >= 0){ s->limiting = p->limiting; }
+	else { s->limiting = (s->damping == damping_linesearch); }
+	freeParser(p);
+	
+	// we want to sort the nodes into variable and fixed, and then
+	// move the terminals of every component to the new node indices
+	int *order = malloc(sizeof(int)*(s->n_count + 1));
+	int *new_index = malloc(sizeof(int)*(s->n_count + 1));
+	for(int i = 0; i < s->n_count; i++){ order[i] = i; }
+	int var_n_count = s->n_count;
+	for(int i = 0; i < var_n_count;){
+		if(!(s->n)[i].is_fixed){ i++; }
+		else {
+			node_t temp = (s->n)[i];
+			(s->n)[i] = (s->n)[var_n_count - 1];
+			(s->n)[var_n_count - 1] = temp;
+			info_t temp_info = s->n_info[i];
+			s->n_info[i] = s->n_info[var_n_count - 1];
+			s->n_info[var_n_count - 1] = temp_info;
+			int temp_order = order[i];
+			order[i] = order[var_n_count - 1];
+			order[var_n_count - 1] = temp_order;
+			var_n_count--;
+		}
+	}
+	s->var_n_count = var_n_count;
+	for(int i = 0; i < s->n_count; i++){ new_index[order[i]] = i; }
+	for(int i = 0; i < s->c_count; i++){
+		for(int j = 0; j < s->c[i].terminals_count; j++){
+			s->c[i].terminals[j] = new_index[s->c[i].terminals[j]];
+		}
+	}
+	free(order); free(new_index);
+	
+	// the nodes and components are done with, and join the parameters
+	component_t *c = s->c; node_t *n = s->n;
+	info_t *c_info = s->c_info, *n_info = s->n_info;
+	s->c = arenaCopy(&s->arena, c, sizeof(component_t)*s->c_count);
+	s->n = arenaCopy(&s->arena, n, sizeof(node_t)*s->n_count);
+	s->c_info = arenaCopy(&s->arena, c_info, sizeof(info_t)*s->c_count);
+	s->n_info = arenaCopy(&s->arena, n_info, sizeof(info_t)*s->n_count);
+	free(c); free(n); free(c_info); free(n_info);
+	
+	// now that the topology is known, work out where each
+	// component's jacobian goes in the simulator's matrix
+	return matrixSetup(s);
+}
+
+// parse the text of a .conf file, which does not need to end in a newline
+int parseText(const char *text, size_t len, sim_t *s){
+	parser_t *p = parseStart(s);
+	if(!parseLines(p, text, len)){
+		parseFree(p);
+		return 0;
+	}
+	return parseFinish(p);
+}
+
+int parseFile(FILE *f, sim_t *s){
+	size_t len;
+	char *text = readFile(f, &len);
+	int ok = parseText(text, len, s);
+	free(text);
+	return ok;
+}
@@ -0,0 +1,97 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<stdlib.h>
+#include<pthread.h>
+#include<unistd.h>
+
+// each poolRun starts a new generation of tasks. the workers take tasks
+// one at a time until there are none left, so long and short tasks still
+// balance out, and poolRun returns once every worker has finished
+struct pool {
+	pthread_t *threads;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t start, finished;
+
+	void (*task)(void *ctx, int index);
+	void *ctx;
+	int next, total, running, generation;
+	uint8_t stop;
+};
+
+// take tasks until there are none left, with the lock held
+static void work(pool_t *p){
+	while(p->next < p->total){
+		int index = p->next++;
+		pthread_mutex_unlock(&p->lock);
+		p->task(p->ctx, index);
+		pthread_mutex_lock(&p->lock);
+	}
+}
+
+static void *workerThread(void *arg){
+	pool_t *p = arg;
+	int seen = 0;
+	pthread_mutex_lock(&p->lock);
+	for(;;){
+		while(p->generation == seen && !p->stop){ pthread_cond_wait(&p->start, &p->lock); }
+		if(p->stop){ break; }
+		seen = p->generation;
+		work(p);
+		if(--p->running == 0){ pthread_cond_signal(&p->finished); }
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+int cpuCount(void){
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0)? n : 1;
+}
+
+// threads includes the calling thread, so threads - 1 workers are
+// started. if some can not be started, the pool makes do without them
+pool_t *poolCreate(int threads){
+	pool_t *p = calloc(1, sizeof(pool_t));
+	p->threads = malloc(sizeof(pthread_t)*(threads + 1));
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->finished, NULL);
+	for(int i = 0; i < threads - 1; i++){
+		if(pthread_create(p->threads + p->count, NULL, workerThread, p) != 0){ break; }
+		p->count++;
+	}
+	return p;
+}
+
+// run task(ctx, index) for every index from 0 to count - 1
+void poolRun(pool_t *p, int count, void (*task)(void *ctx, int index), void *ctx){
+	pthread_mutex_lock(&p->lock);
+	p->task = task;
+	p->ctx = ctx;
+	p->next = 0;
+	p->total = count;
+	p->running = p->count;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	work(p);
+	while(p->running > 0){ pthread_cond_wait(&p->finished, &p->lock); }
+	pthread_mutex_unlock(&p->lock);
+}
+
+void poolDestroy(pool_t *p){
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+	for(int i = 0; i < p->count; i++){ pthread_join(p->threads[i], NULL); }
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->start);
+	pthread_cond_destroy(&p->finished);
+	free(p->threads);
+	free(p);
+}
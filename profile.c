@@ -0,0 +1,100 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<stdio.h>
+#include<time.h>
+#include<sys/resource.h>
+
+static const char *phase_names[phases_count] = {
+	"parse", "device_eval", "assembly", "factor", "solve", "state_update", "output"
+};
+
+double profileClock(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+// time the phases of a simulation back to back: each lap adds the time since
+// the last one to phase, and returns the time to start the next lap from.
+// without profiling the clock is never read, so this costs a single branch
+double profileLap(sim_t *s, phase_t phase, double since){
+	if(!s->profiling){ return 0; }
+	double now = profileClock();
+	s->profile.seconds[phase] += now - since;
+	s->profile.calls[phase]++;
+	return now;
+}
+
+double profileStart(sim_t *s){
+	return s->profiling? profileClock() : 0;
+}
+
+// the work of each factorization and substitution, worked out
+// again whenever the pivot order (and so the fill) changes
+void profileFactorWork(sim_t *s){
+	if(!s->profiling){ return; }
+	profile_t *p = &s->profile;
+	if(s->bbd != NULL){
+		bbdWork(s, &p->factor_flops, &p->solve_flops, &p->factor_span, &p->lu_nnz);
+	} else if(s->solver == solver_sparse){
+		sparseFlops(&s->sparse, &p->factor_flops, &p->solve_flops);
+		p->lu_nnz = s->sparse.l_colptr[s->sparse.n] + s->sparse.u_colptr[s->sparse.n] - s->sparse.n;
+	} else {
+		double n = s->var_n_count;
+		p->factor_flops = 2*n*n*n/3;
+		p->solve_flops = 2*n*n;
+		p->lu_nnz = s->var_n_count*s->var_n_count;
+	}
+}
+
+void profileIterations(sim_t *s, int iters){
+	if(!s->profiling){ return; }
+	if(iters >= profile_bins){ iters = profile_bins - 1; }
+	s->profile.iters_hist[iters]++;
+}
+
+// the report is json, so it can be compared between runs by scripts
+int profileReport(const sim_t *s, FILE *f){
+	const profile_t *p = &s->profile;
+	const stats_t *st = &s->stats;
+	int nnz = (s->solver == solver_sparse)? s->sparse.nnz : s->var_n_count*s->var_n_count;
+	fprintf(f, "{\n");
+	fprintf(f, "  \"circuit\": {\"nodes\": %i, \"variable_nodes\": %i, \"components\": %i, "
+		"\"solver\": \"%s\", \"nnz\": %i, \"lu_nnz\": %i},\n",
+		s->n_count, s->var_n_count, s->c_count,
+		(s->solver == solver_sparse)? "sparse" : "dense", nnz, p->lu_nnz);
+	struct rusage usage;
+	long peak_kb = (getrusage(RUSAGE_SELF, &usage) == 0)? usage.ru_maxrss : 0;
+	fprintf(f, "  \"total_seconds\": %.6e,\n", p->total);
+	fprintf(f, "  \"peak_memory_kb\": %li,\n", peak_kb);
+	fprintf(f, "  \"phases\": {\n");
+	for(int i = 0; i < phases_count; i++){
+		fprintf(f, "    \"%s\": {\"seconds\": %.6e, \"calls\": %lld", phase_names[i], p->seconds[i], p->calls[i]);
+		if(i == phase_factor){ fprintf(f, ", \"flops\": %.6e", p->flops[phase_factor]); }
+		if(i == phase_factor && s->bbd != NULL){ fprintf(f, ", \"span_flops\": %.6e", p->span_flops); }
+		if(i == phase_solve){ fprintf(f, ", \"flops\": %.6e", p->flops[phase_solve]); }
+		fprintf(f, "}%s\n", (i + 1 < phases_count)? "," : "");
+	}
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"newton\": {\"steps\": %i, \"iterations\": %i, \"min_iterations\": %i, \"max_iterations\": %i, "
+		"\"rejected_lte\": %i, \"rejected_newton\": %i, \"factorizations\": %i, \"factor_reuses\": %i, "
+		"\"repivots\": %i, \"limited\": %i, \"backtracks\": %i, \"predicted\": %i, \"checked\": %i, \"fallbacks\": %i, "
+		"\"op_iterations\": %i, \"gmin_steps\": %i, \"source_steps\": %i, "
+		"\"refinements\": %i, \"refine_fallbacks\": %i},\n",
+		st->steps, st->iters_total, st->iters_min, st->iters_max, st->rejected_lte, st->rejected_newton,
+		st->factorizations, st->factor_reuses, st->repivots, st->limited, st->backtracks,
+		st->predicted, st->checked, st->fallbacks, st->op_iters, st->gmin_steps, st->source_steps,
+		st->refinements, st->refine_fallbacks);
+	// the number of newton solves that converged in each number of
+	// iterations, where the last bin also holds any that took longer
+	fprintf(f, "  \"iterations_histogram\": [");
+	for(int i = 0; i < profile_bins; i++){
+		fprintf(f, "%s%i", (i == 0)? "" : ", ", p->iters_hist[i]);
+	}
+	fprintf(f, "]\n}\n");
+	return fflush(f) == 0 && !ferror(f);
+}
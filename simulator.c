@@ -1,249 +1,1332 @@
-/*
- * Author: Joslyn Renfrey
- * Date: 13/01/2023
- */
-
-
-
-
-
-
-#include"circuitsim.h"
-#include<math.h>
-#include<stdio.h>
-#include <string.h>
-#include<stdlib.h>
-
-void vecSub(int n, double *x, double *y, double *r){
-	for(int i = 0; i < n; i++){ r[i] = x[i] - y[i]; }
-}
-
-double vecDot(int n, double *x, double *y){
-	double r = 0;
-	for(int i = 0; i < n; i++){ r += x[i]*y[i]; }
-	return r;
-}
-
-void vecScale(int n, double *x, double s, double *y){
-	for(int i = 0; i < n; i++){ y[i] = s*x[i]; }
-}
-
-int solveLinear(int n, int rowskip, int *swap_indices, double *A, double *b){
-	#define swap(x, y) {double temp = x; x = y; y = temp; }
-	// gaussian elimination with full pivoting
-	for(int pivot = 0; pivot < n; pivot++){
-		// search for the greatest element in the remaining sub matrix
-		int swaprow = pivot, swapcol = pivot;
-		double swap_mag = fabs(A[rowskip*pivot + pivot]);
-		for(int row = pivot; row < n; row++){
-			for(int col = pivot; col < n; col++){
-				double candidate_mag = fabs(A[rowskip*row + col]);
-				if(candidate_mag > swap_mag){
-					swap_mag = candidate_mag, swaprow = row, swapcol = col;
-				}
-			}
-		}
-		
-		// swap the row
-		for(int col = pivot; col < n; col++){
-			swap(A[rowskip*swaprow + col], A[rowskip*pivot + col]);
-		}
-		swap(b[swaprow], b[pivot]);
-		
-		// and swap the column
-		for(int row = 0; row < n; row++){
-			swap(A[rowskip*row + pivot], A[rowskip*row + swapcol]);
-		}
-		
-		// store the column permutation to be undone later
-		swap_indices[pivot] = swapcol;
-		
-		
-		// eliminate pivot column of all lower rows by row scale and subtract
-		for(int row = pivot + 1; row < n; row++){
-			double scale = A[rowskip*row + pivot]/A[rowskip*pivot + pivot];
-			for(int col = pivot; col < n; col++){
-				A[rowskip*row + col] -= scale*A[rowskip*pivot + col];
-			}
-			b[row] -= scale*b[pivot];
-		}
-		
-		if(A[rowskip*pivot + pivot] == 0){ return 0; }
-	}
-	
-	// eliminate upper diagonal
-	for(int pivot = n - 1; pivot >= 0; pivot--){		
-		// normalize the diagonal element in the pivotvot row by row scaling
-		// there are only 2 elements in the pivotvot row
-		double scale = 1/A[rowskip*pivot + pivot];
-		b[pivot] *= scale; A[rowskip*pivot + pivot] *= scale;
-
-		// for each higher row, eliminate the pivotvot column by row scale and subtract
-		// again there are only 2 elements in the pivotvot row.
-		for(int row = pivot - 1; row >= 0; row--){
-			double scale = A[rowskip*row + pivot];
-			b[row] -= scale*b[pivot];
-			A[rowskip*row + pivot] -= scale; // A[rowskip*pivot + pivot] = 1;
-		}
-	}
-	
-	// undo the column swaps in reverse
-	for(int pivot = n - 1; pivot >= 0; pivot--){
-		int swapcol = swap_indices[pivot];
-		swap(b[swapcol], b[pivot]);
-	}
-	return 1;
-}
-
-static void evalErrorAndJacobian(sim_t *s, double *v, double *e, double *jac){	
-	// calculate error vector as the sum of currents at each node,
-	// and the jacobian as the rate of change of the that w.r.t node voltage
-	memset(e, 0, sizeof(double)*s->n_count);
-	memset(jac, 0, sizeof(double)*s->n_count*s->n_count);
-	
-	for(int i = 0; i < s->c_count; i++){
-		// action of G on v. v_term is the fragment of v
-		// that only this component's curve operates on
-		double v_term[max_terms], i_term[max_terms];
-		for(int j = 0; j < s->c[i].terminals_count; j++){
-			v_term[j] = v[s->c[i].terminals[j]];
-		}
-		
-		double jac_term[max_terms*max_terms];
-		s->c[i].currentCurve(s->c[i].parameters, v_term, s->timestep, i_term);
-		s->c[i].jacobian(s->c[i].parameters, v_term, s->timestep, jac_term);
-		
-		// i_term is the corresponding fraction of F(G v)
-		// linearly combine GT i_term from each component
-		// to get the complete e = GT F(G v)
-		for(int j = 0; j < s->c[i].terminals_count; j++){
-			e[s->c[i].terminals[j]] += i_term[j];
-		}
-		
-		for(int col = 0; col < s->c[i].terminals_count; col++){
-			for(int row = 0; row < s->c[i].terminals_count; row++){
-				int tcol = s->c[i].terminals[col], trow = s->c[i].terminals[row];
-				jac[trow*s->n_count + tcol] += jac_term[row*s->c[i].terminals_count + col];
-			}
-		}
-	}
-}
-
-static void printLabels(sim_t *s, FILE *f){
-	fprintf(f, "time(s)");
-	// print labels for measured nodes
-	for(int i = 0; i < s->n_count; i++){
-		if(s->n[i].is_measured){
-			fprintf(f, ", %s(V)", s->n[i].name);
-		}
-	}
-	// print labels for components that are being measured (only supports 2 terminal devices)
-	for(int i = 0; i < s->c_count; i++){
-		if(s->c[i].is_measured && s->c[i].terminals_count == 2){
-			fprintf(f, ", %s(V), %s(A)", s->c[i].name, s->c[i].name);
-		}
-	}
-	fprintf(f, "\n");
-}
-
-static void printState(sim_t *s, double time, double *v, FILE *f){
-	fprintf(f, "%.6e", time);
-	
-	// print voltages for measured nodes
-	for(int i = 0; i < s->n_count; i++){
-		if(s->n[i].is_measured){
-			fprintf(f, ", %.6e", v[i]);
-		}
-	}
-	for(int i = 0; i < s->c_count; i++){
-		// time is advanced by calling updateState time-sensitive components
-		// (capacitors, inductors) with the current voltage and current
-		double v_term[max_terms], i_term[max_terms];
-		for(int j = 0; j < s->c[i].terminals_count; j++){
-			// we need to reconstruct this, since it was clobbed
-			v_term[j] = v[s->c[i].terminals[j]];
-		}
-		s->c[i].currentCurve(s->c[i].parameters, v_term, s->timestep, i_term);
-		s->c[i].updateState(s->c[i].parameters, v_term, s->timestep, i_term);
-		
-		// print voltages and currents for measured components
-		if(s->c[i].is_measured && s->c[i].terminals_count == 2){
-			fprintf(f, ", %.6e, %.6e", v_term[0] - v_term[1], (i_term[0] - i_term[1])/2);
-		}
-	}
-	fprintf(f, "\n");
-}
-
-
-
-int simulate(sim_t *s, FILE *f){
-	double e_sqmag = 0;
-	double *v = malloc(sizeof(double)*s->n_count);
-	double *e = malloc(sizeof(double)*s->n_count);
-	double *jac = malloc(sizeof(double)*s->n_count*s->n_count);
-	int *swap_indices = malloc(sizeof(int)*s->n_count);
-
-
-	int stats_steps = 0;
-	int stats_iters_total = 0;
-	int stats_iters_max = 0;
-	int stats_iters_min = s->maxiter;
-
-	// assume that nodes are sorted by variable nodes, then fixed nodes
-	int var_n_count = 0;
-	for(int i = 0; i < s->n_count; i++){
-		if(!s->n[i].is_fixed){ var_n_count++; v[i] = 0; }
-		else { v[i] = s->n[i].fixed_voltage; }
-	}
-		
-	// the first line will be column labels
-	printLabels(s, f);	
-	
-	for(double time = 0 ; time < s->endtime; time += s->timestep){
-		for(int iter = 0; iter < s->maxiter; iter++){
-			evalErrorAndJacobian(s, v, e, jac);
-			e_sqmag = vecDot(var_n_count, e, e);
-			if(e_sqmag < s->errorsq){
-				if(stats_iters_max < iter){
-					stats_iters_max = iter;
-				}
-				if(iter != 0 && iter < stats_iters_min){
-					stats_iters_min = iter;
-				}
-				break;
-			}
-			
-			//newton's method
-			// multiply inverse jacobian by error vector, result
-			// is stored in the error vector...
-			if(!solveLinear(var_n_count, s->n_count, swap_indices, jac, e)){
-				fprintf(stderr, "error: singular jacobian on time step %.6e, iteration %i\n", time, iter);
-				return 0;
-			}
-			
-			vecScale(var_n_count, e, s->convrate, e);
-			vecSub(var_n_count, v, e, v);
-			stats_iters_total++;
-		}
-		
-		if(e_sqmag < s->errorsq){
-			printState(s, time, v, f);
-			stats_steps++;
-		} else {
-			fprintf(stderr, "error: could not converge at timestep %.6e\n", time);
-			fprintf(stderr, "error: minimum E^2 = %.6g\n", e_sqmag);
-			
-			return 0;
-		}
-	}
-	
-	fprintf(stderr, "cycles = %i, total iterations = %i\n", stats_steps, stats_iters_total);
-	fprintf(stderr, "avg iterations/cycle = %.1f\n", (double) stats_iters_total/(double) stats_steps);
-	fprintf(stderr, "min iterations/cycle = %i\n", stats_iters_min);
-	fprintf(stderr, "max iterations/cycle = %i\n", stats_iters_max);
-	
-	return 1;
-}
-
-	
-
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+
+
+
+
+
+#include"circuitsim.h"
+#include<math.h>
+#include<float.h>
+#include<stdio.h>
+#include <string.h>
+#include<stdlib.h>
+#if defined(__SSE2__)
+#include<xmmintrin.h>
+// the flush to zero and denormals are zero bits of mxcsr
+#define mxcsr_flush 0x8040
+#endif
+
+void vecSub(int n, double *x, double *y, double *r){
+	for(int i = 0; i < n; i++){ r[i] = x[i] - y[i]; }
+}
+
+double vecDot(int n, double *x, double *y){
+	double r = 0;
+	for(int i = 0; i < n; i++){ r += x[i]*y[i]; }
+	return r;
+}
+
+void vecScale(int n, double *x, double s, double *y){
+	for(int i = 0; i < n; i++){ y[i] = s*x[i]; }
+}
+
+// number of elements in the jacobian storage
+static int jacobianSize(sim_t *s){
+	return (s->solver == solver_sparse)? s->sparse.nnz : s->n_count*s->n_count;
+}
+
+// compare the jacobian with the one that was last factorized
+static int jacobianUnchanged(sim_t *s, double *jac){
+	int count = jacobianSize(s);
+	double change = 0, scale = 0;
+	for(int i = 0; i < count; i++){
+		double d = fabs(jac[i] - s->jac_factored[i]);
+		if(d > change){ change = d; }
+		if(fabs(s->jac_factored[i]) > scale){ scale = fabs(s->jac_factored[i]); }
+	}
+	return change <= s->chord_tol*scale;
+}
+
+// r = b - jac x over the variable nodes
+static void residual(sim_t *s, const double *jac, const double *x, const double *b, double *r){
+	int n = s->var_n_count;
+	if(s->solver == solver_sparse){
+		const sparse_t *m = &s->sparse;
+		memcpy(r, b, sizeof(double)*n);
+		for(int col = 0; col < n; col++){
+			for(int p = m->colptr[col]; p < m->colptr[col + 1]; p++){ r[m->rowind[p]] -= jac[p]*x[col]; }
+		}
+		return;
+	}
+	for(int row = 0; row < n; row++){
+		const double *a = jac + row*s->n_count;
+		double sum = b[row];
+		for(int col = 0; col < n; col++){ sum -= a[col]*x[col]; }
+		r[row] = sum;
+	}
+}
+
+static double normInf(int n, const double *x){
+	double norm = 0;
+	for(int i = 0; i < n; i++){
+		if(!(fabs(x[i]) <= norm)){ norm = fabs(x[i]); }
+	}
+	return norm;
+}
+
+// factorize jac in single precision, with the pivot order of the last
+// double precision factorization. returns 1 if it could be, 0 if a pivot
+// was too small in single precision, and -1 if there is no pivot order yet.
+// the fill of a large factorization decays through the subnormal floats,
+// which are many times slower to work with, so where the processor allows
+// they are flushed to zero, which the refinement makes up for
+static int factorSingle(sim_t *s, const double *jac){
+	int n = s->var_n_count, r;
+	int factored = (s->solver == solver_sparse)? s->sparse.factored : s->dense.factored;
+	if(!factored){ return -1; }
+#if defined(__SSE2__)
+	unsigned int csr = _mm_getcsr();
+	_mm_setcsr(csr | mxcsr_flush);
+#endif
+	if(s->solver == solver_sparse){ r = sparseRefactorSingle(&s->sparse, s->pivot_tol); }
+	else { r = denseFactorSingle(&s->dense, jac, s->n_count, s->pivot_tol); }
+#if defined(__SSE2__)
+	_mm_setcsr(csr);
+#endif
+	if(r != 1){ return 0; }
+	
+	// the largest row sum, for judging the residuals against
+	double *sums = s->refine_r;
+	for(int i = 0; i < n; i++){ sums[i] = 0; }
+	if(s->solver == solver_sparse){
+		const sparse_t *m = &s->sparse;
+		for(int p = 0; p < m->colptr[n]; p++){ sums[m->rowind[p]] += fabs(jac[p]); }
+	} else {
+		for(int row = 0; row < n; row++){
+			for(int col = 0; col < n; col++){ sums[row] += fabs(jac[row*s->n_count + col]); }
+		}
+	}
+	s->jac_norm = normInf(n, sums);
+	return 1;
+}
+
+static void solveSingle(sim_t *s, double *x){
+	if(s->solver == solver_sparse){ sparseSolveSingle(&s->sparse, x); }
+	else { denseSolveSingle(&s->dense, x); }
+}
+
+// solve jac x = e with the single precision factors, then correct x with
+// the solution for the residual e - jac x, until the residual is as small
+// as a double precision factorization would leave it. returns 0, with e as
+// it was, if a correction fails to reduce the residual
+static int refine(sim_t *s, const double *jac, double *e){
+	int n = s->var_n_count;
+	double *b = s->refine_b, *r = s->refine_r;
+	double tol = sqrt(n)*DBL_EPSILON;
+	memcpy(b, e, sizeof(double)*n);
+	solveSingle(s, e);
+	double last = INFINITY;
+	for(int iter = 0; iter <= refine_maxiter; iter++){
+		residual(s, jac, e, b, r);
+		double r_norm = normInf(n, r);
+		if(r_norm <= tol*(s->jac_norm*normInf(n, e) + normInf(n, b))){ return 1; }
+		// also stops at nan
+		if(iter == refine_maxiter || !(r_norm < last)){ break; }
+		last = r_norm;
+		solveSingle(s, r);
+		for(int i = 0; i < n; i++){ e[i] += r[i]; }
+		s->stats.refinements++;
+		s->profile.flops[phase_solve] += s->profile.solve_flops + 2.0*jacobianSize(s);
+	}
+	memcpy(e, b, sizeof(double)*n);
+	return 0;
+}
+
+// solve jac x = e for the variable nodes, storing x in e. the pivot order
+// of the last factorization is reused if enabled, and is only searched
+// for again if a pivot has become too small
+static int solveLinear(sim_t *s, double *jac, double *e){
+	int reuse = s->reuse_pivots;
+	int factored = (s->solver == solver_sparse)? s->sparse.factored : s->dense.factored;
+	int single = s->factor_single && s->bbd == NULL;
+	
+	// chord newton skips straight to the substitution with the old factors
+	if(s->chord && factored && !s->refactor && jacobianUnchanged(s, jac)){
+		double t = profileStart(s);
+		int ok = 1;
+		if(s->bbd != NULL){ bbdSolve(s, e); }
+		else if(s->solver == solver_sparse? s->sparse.single : s->dense.single){ ok = refine(s, jac, e); }
+		else if(s->solver == solver_sparse){ sparseSolve(&s->sparse, e); }
+		else { denseSolve(&s->dense, e); }
+		profileLap(s, phase_solve, t);
+		if(ok){
+			s->stats.factor_reuses++;
+			s->profile.flops[phase_solve] += s->profile.solve_flops;
+			return 1;
+		}
+		s->stats.refine_fallbacks++;
+		single = 0;
+	}
+	s->refactor = 0;
+	if(s->chord){
+		memcpy(s->jac_factored, jac, sizeof(double)*jacobianSize(s));
+	}
+	
+	// single precision factors are used if they give a solution as good
+	// as double precision ones would
+	double t = profileStart(s);
+	int r_single = single? factorSingle(s, jac) : -1;
+	if(r_single > 0){
+		s->stats.factorizations++;
+		s->profile.flops[phase_factor] += s->profile.factor_flops;
+		s->profile.span_flops += s->profile.factor_span;
+		t = profileLap(s, phase_factor, t);
+		int ok = refine(s, jac, e);
+		t = profileLap(s, phase_solve, t);
+		if(ok){
+			s->profile.flops[phase_solve] += s->profile.solve_flops;
+			return 1;
+		}
+	}
+	if(r_single >= 0){ s->stats.refine_fallbacks++; }
+	
+	// a fresh pivot search can change the fill, and so the work
+	if(s->bbd != NULL){
+		int repivots = s->stats.repivots;
+		int r = bbdFactor(s, jac);
+		if(r && (!reuse || s->stats.repivots != repivots || s->profile.factor_flops == 0)){ profileFactorWork(s); }
+		s->stats.factorizations++;
+		t = profileLap(s, phase_factor, t);
+		if(!r){ return 0; }
+		bbdSolve(s, e);
+	} else if(s->solver == solver_sparse){
+		int r = -1;
+		if(reuse && s->sparse.factored){
+			r = sparseRefactor(&s->sparse, s->pivot_tol);
+			if(r < 0){ s->stats.repivots++; }
+		}
+		if(r < 0 && (r = sparseFactor(&s->sparse))){ profileFactorWork(s); }
+		s->stats.factorizations++;
+		t = profileLap(s, phase_factor, t);
+		if(!r){ return 0; }
+		sparseSolve(&s->sparse, e);
+	} else {
+		int r = -1;
+		if(reuse && s->dense.factored){
+			r = denseFactor(&s->dense, jac, s->n_count, 0, s->pivot_tol);
+			if(r < 0){ s->stats.repivots++; }
+		}
+		if(r < 0 && (r = denseFactor(&s->dense, jac, s->n_count, 1, s->pivot_tol))){ profileFactorWork(s); }
+		s->stats.factorizations++;
+		t = profileLap(s, phase_factor, t);
+		if(!r){ return 0; }
+		denseSolve(&s->dense, e);
+	}
+	profileLap(s, phase_solve, t);
+	s->profile.flops[phase_factor] += s->profile.factor_flops;
+	s->profile.span_flops += s->profile.factor_span;
+	s->profile.flops[phase_solve] += s->profile.solve_flops;
+	return 1;
+}
+
+// add a single component's currents and jacobian in to e and jac.
+// its currents are left in i_term. if v_last is given, the component is
+// limited from the voltages there, and they are replaced by the new ones
+static void stampComponent(sim_t *s, component_t *c, const double *v, double *e, double *jac, double *i_term, double *v_last){
+	// action of G on v. v_term is the fragment of v
+	// that only this component's curve operates on
+	double v_term[max_terms], v_eval[max_terms];
+	for(int j = 0; j < c->terminals_count; j++){
+		v_term[j] = v_eval[j] = v[c->terminals[j]];
+	}
+	if(v_last != NULL){
+		if(c->ops->limit(c->parameters, v_last, v_eval)){ s->limited = 1; }
+		memcpy(v_last, v_eval, sizeof(double)*c->terminals_count);
+	}
+	
+	// components without a load have the separate functions instead
+	double jac_term[max_terms*max_terms];
+	if(c->ops->load != NULL){
+		c->ops->load(c->parameters, v_eval, s->step, i_term, jac_term);
+	} else {
+		c->ops->currentCurve(c->parameters, v_eval, s->step, i_term);
+		c->ops->jacobian(c->parameters, v_eval, s->step, jac_term);
+	}
+	
+	// a limited component is linearised about the voltages it was evaluated
+	// at, which gives its currents at the real voltages
+	if(v_last != NULL){
+		int n = c->terminals_count;
+		for(int row = 0; row < n; row++){
+			for(int col = 0; col < n; col++){
+				i_term[row] += jac_term[row*n + col]*(v_term[col] - v_eval[col]);
+			}
+		}
+	}
+	
+	// i_term is the corresponding fraction of F(G v)
+	// linearly combine GT i_term from each component
+	// to get the complete e = GT F(G v)
+	for(int j = 0; j < c->terminals_count; j++){
+		e[c->terminals[j]] += i_term[j];
+	}
+	
+	// the index of each element was worked out when parsing
+	for(int k = 0; k < c->terminals_count*c->terminals_count; k++){
+		int index = s->jac_index[c->jac_start + k];
+		if(index >= 0){ jac[index] += jac_term[k]; }
+	}
+}
+
+// the currents of a component on their own, which come from its load
+// (throwing away the jacobian) if it has no currentCurve
+static void componentCurrents(const sim_t *s, const component_t *c, const double *v_term, double *i_term){
+	if(c->ops->currentCurve != NULL){
+		c->ops->currentCurve(c->parameters, v_term, s->step, i_term);
+		return;
+	}
+	double j_term[max_terms*max_terms];
+	c->ops->load(c->parameters, v_term, s->step, i_term, j_term);
+}
+
+// the constant linear components, from the voltages of the fixed nodes
+static void stampConstant(sim_t *s){
+	memset(s->jac_const, 0, sizeof(double)*jacobianSize(s));
+	memset(s->e_const, 0, sizeof(double)*s->n_count);
+	for(int i = 0; i < s->n_count; i++){
+		s->v_fixed[i] = s->n[i].is_fixed? s->n[i].fixed_voltage : 0;
+	}
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c[i].linearity == linear_constant){
+			double i_term[max_terms];
+			stampComponent(s, s->c + i, s->v_fixed, s->e_const, s->jac_const, i_term, NULL);
+		}
+	}
+}
+
+// sort the components by how often they need evaluating, and stamp
+// the constant linear components, which never need stamping again
+static void setupLinearStamps(sim_t *s){
+	int count = jacobianSize(s);
+	s->jac_const = arenaAlloc(&s->arena, sizeof(double)*count);
+	s->jac_linear = arenaAlloc(&s->arena, sizeof(double)*count);
+	s->e_const = arenaAlloc(&s->arena, sizeof(double)*s->n_count);
+	s->e_linear = arenaAlloc(&s->arena, sizeof(double)*s->n_count);
+	s->v_fixed = arenaAlloc(&s->arena, sizeof(double)*s->n_count);
+	s->nonlinear = arenaAlloc(&s->arena, sizeof(int)*(s->c_count + 1));
+	s->nonlinear_count = 0;
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c[i].linearity == nonlinear && s->c[i].ops->evalBatch == NULL){
+			s->nonlinear[s->nonlinear_count++] = i;
+		}
+	}
+	stampConstant(s);
+}
+
+// greedy colouring of the components of a group, taken in their order, so
+// that no two of a colour share a variable node. members is then sorted by
+// colour, keeping the order within each colour
+static void colorGroup(sim_t *s, device_group_t *g, int *members){
+	int count = g->count, tc = g->terminals_count, n = s->var_n_count, colors = 0;
+	int *color = malloc(sizeof(int)*(count + 1));
+	// the colours already at each node, as linked lists
+	int *head = malloc(sizeof(int)*(n + 1)), entries = 0;
+	int *next = malloc(sizeof(int)*(count*tc + 1)), *entry_color = malloc(sizeof(int)*(count*tc + 1));
+	int *used = calloc(count + 1, sizeof(int));
+	for(int i = 0; i < n; i++){ head[i] = -1; }
+	for(int k = 0; k < count; k++){
+		const int *terminals = s->c[members[k]].terminals;
+		for(int t = 0; t < tc; t++){
+			if(terminals[t] >= n){ continue; }
+			for(int p = head[terminals[t]]; p >= 0; p = next[p]){ used[entry_color[p]] = k + 1; }
+		}
+		int c = 0;
+		while(used[c] == k + 1){ c++; }
+		color[k] = c;
+		if(c >= colors){ colors = c + 1; }
+		for(int t = 0; t < tc; t++){
+			if(terminals[t] >= n){ continue; }
+			entry_color[entries] = c;
+			next[entries] = head[terminals[t]];
+			head[terminals[t]] = entries++;
+		}
+	}
+	
+	g->colors_count = colors;
+	g->color_start = arenaAlloc(&s->arena, sizeof(int)*(colors + 1));
+	for(int k = 0; k < count; k++){ g->color_start[color[k] + 1]++; }
+	for(int c = 0; c < colors; c++){ g->color_start[c + 1] += g->color_start[c]; }
+	int *fill = malloc(sizeof(int)*(colors + 1)), *sorted = malloc(sizeof(int)*(count + 1));
+	memcpy(fill, g->color_start, sizeof(int)*colors);
+	for(int k = 0; k < count; k++){ sorted[fill[color[k]]++] = members[k]; }
+	memcpy(members, sorted, sizeof(int)*count);
+	free(color); free(head); free(next); free(entry_color); free(used); free(fill); free(sorted);
+}
+
+// gather the nonlinear components that have a batch evaluation in to a
+// group for each type, with their parameters (including those derived by
+// setup) and terminals in arrays, each starting on a cache line
+static void setupDeviceGroups(sim_t *s){
+	arena_t *a = &s->arena;
+	s->groups = arenaAlloc(a, sizeof(device_group_t)*(s->c_count + 1));
+	s->groups_count = 0;
+	for(int i = 0; i < s->c_count; i++){
+		component_t *c = s->c + i;
+		if(c->linearity != nonlinear || c->ops->evalBatch == NULL){ continue; }
+		int found = 0;
+		for(int k = 0; k < s->groups_count; k++){
+			if(s->groups[k].evalBatch == c->ops->evalBatch){ found = 1; }
+		}
+		if(found){ continue; }
+		
+		// count the components of this type, then fill in the arrays
+		device_group_t *g = s->groups + s->groups_count++;
+		memset(g, 0, sizeof(device_group_t));
+		g->evalBatch = c->ops->evalBatch;
+		g->limit = s->limiting? c->ops->limit : NULL;
+		g->terminals_count = c->terminals_count;
+		g->parameters_count = c->ops->parameters_count;
+		for(int k = i; k < s->c_count; k++){
+			if(s->c[k].linearity == nonlinear && s->c[k].ops->evalBatch == g->evalBatch){ g->count++; }
+		}
+		int tt = g->terminals_count*g->terminals_count;
+		for(int p = 0; p < max_params; p++){ g->parameters[p] = arenaAlloc(a, sizeof(double)*g->count); }
+		g->components = arenaAlloc(a, sizeof(int)*g->count);
+		for(int t = 0; t < g->terminals_count; t++){
+			g->terminals[t] = arenaAlloc(a, sizeof(int)*g->count);
+			g->v[t] = arenaAlloc(a, sizeof(double)*g->count);
+			g->i[t] = arenaAlloc(a, sizeof(double)*g->count);
+			g->dv[t] = arenaAlloc(a, sizeof(double)*g->count);
+		}
+		for(int m = 0; m < tt; m++){
+			g->jac_index[m] = arenaAlloc(a, sizeof(int)*g->count);
+			g->j[m] = arenaAlloc(a, sizeof(double)*g->count);
+		}
+		g->chunk_limited = arenaAlloc(a, g->count/eval_chunk + 1);
+		int n = 0;
+		for(int k = i; k < s->c_count; k++){
+			component_t *d = s->c + k;
+			if(d->linearity == nonlinear && d->ops->evalBatch == g->evalBatch){ g->components[n++] = k; }
+		}
+		colorGroup(s, g, g->components);
+		for(n = 0; n < g->count; n++){
+			component_t *d = s->c + g->components[n];
+			for(int p = 0; p < max_params; p++){ g->parameters[p][n] = d->parameters[p]; }
+			for(int t = 0; t < g->terminals_count; t++){ g->terminals[t][n] = d->terminals[t]; }
+			for(int m = 0; m < tt; m++){ g->jac_index[m][n] = s->jac_index[d->jac_start + m]; }
+		}
+	}
+}
+
+// limit components from to to of a group, keeping how far each was moved.
+// returns 1 if any were limited
+static int limitGroup(sim_t *s, device_group_t *g, int from, int to){
+	int tc = g->terminals_count, limited = 0;
+	for(int k = from; k < to; k++){
+		component_t *c = s->c + g->components[k];
+		double *v_last = s->v_last + g->components[k]*max_terms, v_eval[max_terms];
+		for(int t = 0; t < tc; t++){ v_eval[t] = g->v[t][k]; }
+		if(g->limit(c->parameters, v_last, v_eval)){ limited = 1; }
+		for(int t = 0; t < tc; t++){
+			g->dv[t][k] = g->v[t][k] - v_eval[t];
+			g->v[t][k] = v_last[t] = v_eval[t];
+		}
+	}
+	return limited;
+}
+
+// evaluate components from to to of a group in one go. returns 1 if any were limited
+static int evalGroupRange(sim_t *s, device_group_t *g, const double *v, int from, int to){
+	int tc = g->terminals_count, limited = 0;
+	for(int t = 0; t < tc; t++){
+		const int *terminal = g->terminals[t];
+		double *v_term = g->v[t];
+		for(int k = from; k < to; k++){ v_term[k] = v[terminal[k]]; }
+	}
+	if(g->limit != NULL){ limited = limitGroup(s, g, from, to); }
+	double *parameters[max_params], *v_term[max_terms], *i_term[max_terms], *j_term[max_terms*max_terms];
+	for(int p = 0; p < max_params; p++){ parameters[p] = g->parameters[p] + from; }
+	for(int t = 0; t < tc; t++){ v_term[t] = g->v[t] + from; i_term[t] = g->i[t] + from; }
+	for(int m = 0; m < tc*tc; m++){ j_term[m] = g->j[m] + from; }
+	g->evalBatch(to - from, parameters, v_term, s->step, i_term, j_term);
+	// the currents at the real voltages, as in stampComponent
+	if(g->limit != NULL){
+		for(int row = 0; row < tc; row++){
+			for(int col = 0; col < tc; col++){
+				double *i_row = g->i[row];
+				const double *j_elem = g->j[row*tc + col], *dv = g->dv[col];
+				for(int k = from; k < to; k++){ i_row[k] += j_elem[k]*dv[k]; }
+			}
+		}
+	}
+	return limited;
+}
+
+// add the currents and jacobian of components from to to in to e and jac.
+// only the variable nodes are added to, so the components of a colour
+// never write to the same element
+static void scatterGroupRange(sim_t *s, device_group_t *g, double *e, double *jac, int from, int to){
+	int n = s->var_n_count;
+	for(int t = 0; t < g->terminals_count; t++){
+		const int *terminal = g->terminals[t];
+		const double *i_term = g->i[t];
+		for(int k = from; k < to; k++){
+			if(terminal[k] < n){ e[terminal[k]] += i_term[k]; }
+		}
+	}
+	for(int m = 0; m < g->terminals_count*g->terminals_count; m++){
+		const int *index = g->jac_index[m];
+		const double *j_term = g->j[m];
+		for(int k = from; k < to; k++){
+			if(index[k] >= 0){ jac[index[k]] += j_term[k]; }
+		}
+	}
+}
+
+// a group shared between the threads of a simulation
+typedef struct {
+	sim_t *s;
+	device_group_t *g;
+	const double *v;
+	double *e, *jac;
+	int first, last;
+} group_work_t;
+
+static void evalTask(void *ctx, int index){
+	group_work_t *w = ctx;
+	satExpUse(w->s->table);
+	int from = index*eval_chunk, to = (from + eval_chunk < w->g->count)? from + eval_chunk : w->g->count;
+	w->g->chunk_limited[index] = evalGroupRange(w->s, w->g, w->v, from, to);
+}
+
+static void scatterTask(void *ctx, int index){
+	group_work_t *w = ctx;
+	int from = w->first + index*eval_chunk, to = (from + eval_chunk < w->last)? from + eval_chunk : w->last;
+	scatterGroupRange(w->s, w->g, w->e, w->jac, from, to);
+}
+
+// evaluate a group a chunk at a time, then add its currents and jacobian in
+// to e and jac a colour at a time. the chunks and colours are the same
+// whether or not they are shared between threads, so are the results
+static void stampGroup(sim_t *s, device_group_t *g, const double *v, double *e, double *jac){
+	int chunks = (g->count + eval_chunk - 1)/eval_chunk;
+	group_work_t w = {s, g, v, e, jac, 0, g->count};
+	if(s->eval_pool != NULL && chunks > 1){ poolRun(s->eval_pool, chunks, evalTask, &w); }
+	else {
+		for(int k = 0; k < chunks; k++){ evalTask(&w, k); }
+	}
+	for(int k = 0; k < chunks; k++){
+		if(g->chunk_limited[k]){ s->limited = 1; }
+	}
+	for(int c = 0; c < g->colors_count; c++){
+		w.first = g->color_start[c];
+		w.last = g->color_start[c + 1];
+		int tasks = (w.last - w.first + eval_chunk - 1)/eval_chunk;
+		if(s->eval_pool != NULL && tasks > 1){ poolRun(s->eval_pool, tasks, scatterTask, &w); }
+		else { scatterGroupRange(s, g, e, jac, w.first, w.last); }
+	}
+}
+
+// the reactive components only change when their state is updated
+static void stampReactive(sim_t *s){
+	double t = profileStart(s);
+	memcpy(s->jac_linear, s->jac_const, sizeof(double)*jacobianSize(s));
+	memcpy(s->e_linear, s->e_const, sizeof(double)*s->n_count);
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c[i].linearity == linear_reactive){
+			double i_term[max_terms];
+			stampComponent(s, s->c + i, s->v_fixed, s->e_linear, s->jac_linear, i_term, NULL);
+		}
+	}
+	profileLap(s, phase_assembly, t);
+}
+
+static void evalErrorAndJacobian(sim_t *s, double *v, double *e, double *jac){	
+	// calculate error vector as the sum of currents at each node,
+	// and the jacobian as the rate of change of the that w.r.t node voltage.
+	// the linear components contribute e_linear + jac_linear*v
+	int n = s->var_n_count;
+	double t = profileStart(s);
+	s->limited = 0;
+	satExpUse(s->table);
+	memcpy(jac, s->jac_linear, sizeof(double)*jacobianSize(s));
+	memcpy(e, s->e_linear, sizeof(double)*s->n_count);
+	if(s->solver == solver_sparse){
+		sparse_t *m = &s->sparse;
+		for(int col = 0; col < n; col++){
+			for(int p = m->colptr[col]; p < m->colptr[col + 1]; p++){
+				e[m->rowind[p]] += jac[p]*v[col];
+			}
+		}
+	} else {
+		for(int row = 0; row < n; row++){
+			double sum = 0;
+			for(int col = 0; col < n; col++){ sum += jac[row*s->n_count + col]*v[col]; }
+			e[row] += sum;
+		}
+	}
+	
+	t = profileLap(s, phase_assembly, t);
+	
+	// then only the nonlinear components have to be evaluated,
+	// a whole type at a time where they can be
+	for(int i = 0; i < s->groups_count; i++){
+		stampGroup(s, s->groups + i, v, e, jac);
+	}
+	for(int i = 0; i < s->nonlinear_count; i++){
+		int k = s->nonlinear[i];
+		double *v_last = (s->limiting && s->c[k].ops->limit != NULL)? s->v_last + k*max_terms : NULL;
+		stampComponent(s, s->c + k, v, e, jac, s->currents + k*max_terms, v_last);
+	}
+	if(s->limited){ s->stats.limited++; }
+	profileLap(s, phase_eval, t);
+}
+
+// finish an accepted time step: time is advanced by calling updateState on
+// the time-sensitive components (capacitors, inductors) with the current
+// voltage and current, and the measured values are collected in rec. the
+// last iteration of newton's method was evaluated at v, so the nonlinear
+// components already have their currents, only the linear ones are needed
+static void acceptState(sim_t *s, double *v, double *rec){
+	double t = profileStart(s);
+	for(int n = 0; n < s->groups_count; n++){
+		device_group_t *g = s->groups + n;
+		for(int t = 0; t < g->terminals_count; t++){
+			for(int k = 0; k < g->count; k++){
+				s->currents[g->components[k]*max_terms + t] = g->i[t][k];
+			}
+		}
+	}
+	
+	for(int i = 0; i < s->c_count; i++){
+		double v_term[max_terms];
+		for(int j = 0; j < s->c[i].terminals_count; j++){
+			// we need to reconstruct this, since it was clobbed
+			v_term[j] = v[s->c[i].terminals[j]];
+		}
+		// the currents of every component are left in currents
+		double *i_term = s->currents + i*max_terms;
+		if(s->c[i].linearity != nonlinear){ componentCurrents(s, s->c + i, v_term, i_term); }
+		if(s->c[i].ops->updateState != NULL){
+			s->c[i].ops->updateState(s->c[i].parameters, v_term, s->step, i_term);
+		}
+	}
+	
+	// voltages and currents for measured nodes and components
+	int k = 0;
+	for(int m = 0; m < s->measured_n_count; m++){ rec[k++] = v[s->measured_n[m]]; }
+	for(int m = 0; m < s->measured_c_count; m++){
+		const component_t *c = s->c + s->measured_c[m];
+		const double *i_term = s->currents + s->measured_c[m]*max_terms;
+		rec[k++] = v[c->terminals[0]] - v[c->terminals[1]];
+		rec[k++] = (i_term[0] - i_term[1])/2;
+	}
+	profileLap(s, phase_update, t);
+}
+
+// hand a row of measured values to the output, if there is one
+static void recordStep(sim_t *s, output_t *o, double time, const double *rec){
+	if(o == NULL){ return; }
+	double t = profileStart(s);
+	outputRecord(o, time, rec);
+	profileLap(s, phase_output, t);
+}
+
+// the largest truncation error of all the components, relative to their
+// tolerance, if the new solution v was accepted
+static double truncationError(sim_t *s, double *v){
+	double ratio = 0;
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c[i].linearity != linear_reactive || s->c[i].ops->truncError == NULL){ continue; }
+		double v_term[max_terms], i_term[max_terms];
+		for(int j = 0; j < s->c[i].terminals_count; j++){
+			v_term[j] = v[s->c[i].terminals[j]];
+		}
+		componentCurrents(s, s->c + i, v_term, i_term);
+		double r = s->c[i].ops->truncError(s->c[i].parameters, v_term, s->step, i_term, &s->tol);
+		if(r > ratio){ ratio = r; }
+	}
+	return ratio;
+}
+
+// backtrack along the newton step in e from v, until the squared error is
+// reduced by enough (the armijo condition) or the step is as short as it is
+// allowed to be. e and jac are left evaluated at the new v
+static double lineSearch(sim_t *s, double *v, double *e, double *jac, double e_sqmag){
+	int n = s->var_n_count;
+	memcpy(s->v_base, v, sizeof(double)*n);
+	memcpy(s->newton_step, e, sizeof(double)*n);
+	// each try is limited from where the step started
+	if(s->limiting){ memcpy(s->v_last_saved, s->v_last, sizeof(double)*s->c_count*max_terms); }
+	double lambda = 1, trial_sqmag;
+	for(;;){
+		for(int i = 0; i < n; i++){ v[i] = s->v_base[i] - lambda*s->newton_step[i]; }
+		evalErrorAndJacobian(s, v, e, jac);
+		trial_sqmag = vecDot(n, e, e);
+		if(trial_sqmag <= (1 - 2*linesearch_decrease*lambda)*e_sqmag){ break; }
+		if(lambda <= linesearch_min_step){
+			if(!s->limiting){ break; }
+			lambda = 1;
+			if(s->limiting){ memcpy(s->v_last, s->v_last_saved, sizeof(double)*s->c_count*max_terms); }
+			for(int i = 0; i < n; i++){ v[i] = s->v_base[i] - lambda*s->newton_step[i]; }
+			evalErrorAndJacobian(s, v, e, jac);
+			trial_sqmag = vecDot(n, e, e);
+			break;
+		}
+		lambda /= 2;
+		s->stats.backtracks++;
+		if(s->limiting){ memcpy(s->v_last, s->v_last_saved, sizeof(double)*s->c_count*max_terms); }
+	}
+	return trial_sqmag;
+}
+
+// newton's method for the time step currently set up in s. returns 1 once
+// converged, 0 if it ran out of iterations, and -1 if the jacobian was singular
+static int newton(sim_t *s, double *v, double *e, double *jac, double *e_sqmag){
+	int var_n_count = s->var_n_count;
+	int linesearch = (s->damping == damping_linesearch);
+	double last_e_sqmag = 0;
+	*e_sqmag = 0;
+	for(int iter = 0; iter < s->maxiter; iter++){
+		// the line search (or predictor) leaves the error evaluated at the new point
+		if(iter == 0 && s->evaluated){
+			*e_sqmag = vecDot(var_n_count, e, e);
+		} else if(iter == 0 || !linesearch){
+			evalErrorAndJacobian(s, v, e, jac);
+			*e_sqmag = vecDot(var_n_count, e, e);
+		}
+		s->evaluated = 0;
+		if(*e_sqmag < s->errorsq && !s->limited){
+			if(s->stats.iters_max < iter){
+				s->stats.iters_max = iter;
+			}
+			if(iter < s->stats.iters_min){
+				s->stats.iters_min = iter;
+			}
+			profileIterations(s, iter);
+			return 1;
+		}
+		// the old factors are no longer good enough if convergence has slowed
+		if(iter != 0 && *e_sqmag > chord_slow_ratio*last_e_sqmag){
+			s->refactor = 1;
+		}
+		last_e_sqmag = *e_sqmag;
+		
+		//newton's method
+		// multiply inverse jacobian by error vector, result
+		// is stored in the error vector...
+		if(!solveLinear(s, jac, e)){
+			return -1;
+		}
+		
+		s->stats.iters_total++;
+		if(linesearch){
+			*e_sqmag = lineSearch(s, v, e, jac, *e_sqmag);
+			continue;
+		}
+		vecScale(var_n_count, e, s->convrate, e);
+		vecSub(var_n_count, v, e, v);
+	}
+	return 0;
+}
+
+// keep the voltages of an accepted step at time, for the predictor
+static void pushHistory(sim_t *s, const double *v, double time){
+	if(s->predictor == 0){ return; }
+	int n = s->var_n_count;
+	if(s->history_count < s->predictor + 1){ s->history_count++; }
+	memmove(s->history + n, s->history, sizeof(double)*n*(s->history_count - 1));
+	memmove(s->history_time + 1, s->history_time, sizeof(double)*(s->history_count - 1));
+	memcpy(s->history, v, sizeof(double)*n);
+	s->history_time[0] = time;
+}
+
+// the currents of the nonlinear components from the last evaluation, which
+// the groups keep in their own arrays, are saved to (or restored from) kept
+static void keepCurrents(sim_t *s, double *kept, int restore){
+	size_t size = sizeof(double)*s->c_count*max_terms;
+	if(restore){ memcpy(s->currents, kept, size); }
+	else { memcpy(kept, s->currents, size); }
+	for(int n = 0; n < s->groups_count; n++){
+		device_group_t *g = s->groups + n;
+		for(int t = 0; t < g->terminals_count; t++){
+			for(int k = 0; k < g->count; k++){
+				double *slot = kept + g->components[k]*max_terms + t;
+				if(restore){ g->i[t][k] = *slot; }
+				else { *slot = g->i[t][k]; }
+			}
+		}
+	}
+}
+
+// extrapolate the voltages of the last accepted steps to time, with the
+// lagrange polynomial through as many of them as the order allows. the last
+// solution is in v. the prediction is evaluated first, and is used straight
+// away if its error is not much more than the last step started from.
+// otherwise v is evaluated too, and the prediction only replaces it if it
+// has a smaller error. either way, e and jac are left evaluated at the v
+// that newton's method starts from, and so are the currents and limiting
+static int predict(sim_t *s, double *v, double *e, double *jac, double time){
+	int n = s->var_n_count, points = s->history_count;
+	if(s->predictor == 0 || points < 2){ return 0; }
+	double weight[max_predictor + 1];
+	for(int i = 0; i < points; i++){
+		weight[i] = 1;
+		for(int j = 0; j < points; j++){
+			if(j != i){ weight[i] *= (time - s->history_time[j])/(s->history_time[i] - s->history_time[j]); }
+		}
+	}
+	memcpy(s->prediction, v, sizeof(double)*s->n_count);
+	for(int k = 0; k < n; k++){
+		double x = 0;
+		for(int i = 0; i < points; i++){ x += weight[i]*s->history[i*n + k]; }
+		s->prediction[k] = x;
+	}
+	
+	size_t v_last_size = sizeof(double)*s->c_count*max_terms;
+	if(s->limiting){ memcpy(s->v_last_saved, s->v_last, v_last_size); }
+	evalErrorAndJacobian(s, s->prediction, s->e_trial, s->jac_trial);
+	s->evaluated = 1;
+	double e_predicted = vecDot(n, s->e_trial, s->e_trial);
+	if(e_predicted > predictor_slack*s->e_start){
+		// what the evaluation of the prediction left behind is
+		// put back if the last solution turns out to be worse
+		uint8_t limited = s->limited;
+		keepCurrents(s, s->currents_saved, 0);
+		if(s->limiting){
+			memcpy(s->v_last_trial, s->v_last, v_last_size);
+			memcpy(s->v_last, s->v_last_saved, v_last_size);
+		}
+		evalErrorAndJacobian(s, v, e, jac);
+		double e_last = vecDot(n, e, e);
+		s->stats.checked++;
+		if(e_predicted > e_last){
+			s->e_start = e_last;
+			s->stats.fallbacks++;
+			return 0;
+		}
+		if(s->limiting){ memcpy(s->v_last, s->v_last_trial, v_last_size); }
+		keepCurrents(s, s->currents_saved, 1);
+		s->limited = limited;
+	}
+	s->e_start = e_predicted;
+	memcpy(e, s->e_trial, sizeof(double)*s->n_count);
+	memcpy(jac, s->jac_trial, sizeof(double)*jacobianSize(s));
+	memcpy(v, s->prediction, sizeof(double)*n);
+	s->stats.predicted++;
+	return 1;
+}
+
+// newton's method from a predicted starting point, counting the
+// iterations of the steps that used the prediction
+static int predictAndSolve(sim_t *s, double *v, double *e, double *jac, double *e_sqmag, double time){
+	int iters = s->stats.iters_total;
+	int predicted = predict(s, v, e, jac, time);
+	int r = newton(s, v, e, jac, e_sqmag);
+	if(predicted){ s->stats.iters_predicted += s->stats.iters_total - iters; }
+	else { s->stats.iters_unpredicted += s->stats.iters_total - iters; }
+	return r;
+}
+
+// adaptive time steps: each step is accepted only if newton's method
+// converges and the truncation error is within tolerance, otherwise it is
+// retried with a smaller step. the step grows again while the error is
+// small, and the output is interpolated on to multiples of timestep.
+// the first point is solved just like a fixed time step
+static int stepAdaptive(sim_t *s, run_t *run, output_t *o){
+	double e_sqmag = 0;
+	double *v = run->v, *e = run->e, *jac = run->jac;
+	if(!run->started){
+		stampReactive(s);
+		if(newton(s, v, e, jac, &e_sqmag) <= 0){
+			fprintf(stderr, "error: could not converge at timestep %.6e\n", 0.0);
+			return 0;
+		}
+		acceptState(s, v, run->rec_last);
+		recordStep(s, o, 0, run->rec_last);
+		pushHistory(s, v, 0);
+		s->stats.steps++;
+		run->started = 1;
+		return 1;
+	}
+	
+	double maxstep = s->maxstep > 0? s->maxstep : s->endtime/50;
+	double minstep = s->minstep > 0? s->minstep : s->timestep*1e-9;
+	for(;;){
+		double step = fmin(fmin(run->step, maxstep), s->endtime - run->time);
+		s->step = step;
+		memcpy(run->v_last, v, sizeof(double)*s->n_count);
+		stampReactive(s);
+		int r = predictAndSolve(s, v, e, jac, &e_sqmag, run->time + step);
+		
+		double ratio = (r > 0)? truncationError(s, v) : 0;
+		if(r <= 0 || ratio > 1){
+			// reject the step, and try again from the last point
+			memcpy(v, run->v_last, sizeof(double)*s->n_count);
+			if(r <= 0){
+				s->stats.rejected_newton++;
+				step /= 8;
+			} else {
+				s->stats.rejected_lte++;
+				step *= fmax(0.1, 0.9*pow(ratio, -1.0/3));
+			}
+			if(step < minstep){
+				fprintf(stderr, "error: could not converge at timestep %.6e\n", run->time);
+				fprintf(stderr, "error: minimum E^2 = %.6g, step = %.3e\n", e_sqmag, step);
+				return 0;
+			}
+			run->step = step;
+			continue;
+		}
+		
+		acceptState(s, v, run->rec);
+		run->time += step;
+		run->accepted = run->time;
+		pushHistory(s, v, run->time);
+		s->stats.steps++;
+		if(step < s->stats.step_min){ s->stats.step_min = step; }
+		if(step > s->stats.step_max){ s->stats.step_max = step; }
+		
+		// linear interpolation of the output samples that were stepped over
+		for(; run->sample <= run->time && run->sample < s->endtime; run->sample += s->timestep){
+			double t = (run->sample - (run->time - step))/step;
+			for(int i = 0; i < run->rec_count; i++){
+				run->rec_sample[i] = run->rec_last[i] + t*(run->rec[i] - run->rec_last[i]);
+			}
+			recordStep(s, o, run->sample, run->rec_sample);
+		}
+		memcpy(run->rec_last, run->rec, sizeof(double)*run->rec_count);
+		
+		// the trapezoidal error grows with the cube of the step
+		run->step = step*((ratio > 0)? fmin(2, 0.9*pow(ratio, -1.0/3)) : 2);
+		return 1;
+	}
+}
+
+static int stepFixed(sim_t *s, run_t *run, output_t *o){
+	double e_sqmag = 0;
+	stampReactive(s);
+	int r = predictAndSolve(s, run->v, run->e, run->jac, &e_sqmag, run->time);
+	if(r < 0){
+		fprintf(stderr, "error: singular jacobian on time step %.6e\n", run->time);
+		return 0;
+	}
+	if(r == 0){
+		fprintf(stderr, "error: could not converge at timestep %.6e\n", run->time);
+		fprintf(stderr, "error: minimum E^2 = %.6g\n", e_sqmag);
+		return 0;
+	}
+	acceptState(s, run->v, run->rec);
+	recordStep(s, o, run->time, run->rec);
+	pushHistory(s, run->v, run->time);
+	s->stats.steps++;
+	run->accepted = run->time;
+	run->time += s->timestep;
+	return 1;
+}
+
+// take the next accepted time step, and record it to o unless that is
+// NULL. returns 0 if the step could not be solved
+int runStep(sim_t *s, run_t *run, output_t *o){
+	return s->adaptive? stepAdaptive(s, run, o) : stepFixed(s, run, o);
+}
+
+int runDone(sim_t *s, run_t *run){
+	if(s->adaptive){ return run->started && run->sample >= s->endtime; }
+	return run->time >= s->endtime;
+}
+
+// add a conductance g from every variable node to ground
+static void addGmin(sim_t *s, double *jac, double g){
+	for(int i = 0; i < s->var_n_count; i++){
+		if(s->solver == solver_dense){
+			jac[i*s->n_count + i] += g;
+			continue;
+		}
+		for(int p = s->sparse.colptr[i]; p < s->sparse.colptr[i + 1]; p++){
+			if(s->sparse.rowind[p] == i){ jac[p] += g; break; }
+		}
+	}
+}
+
+// the linear part of the circuit at dc, in place of stampReactive. the fixed
+// voltages (in v too) are scaled by ramp, and the reactive components are
+// evaluated by their dcLoad
+static void stampDC(sim_t *s, double *v, double ramp, double gmin){
+	memset(s->jac_linear, 0, sizeof(double)*jacobianSize(s));
+	memset(s->e_linear, 0, sizeof(double)*s->n_count);
+	double *v_ramp = s->v_ramp;
+	for(int i = 0; i < s->n_count; i++){ v_ramp[i] = ramp*s->v_fixed[i]; }
+	for(int i = s->var_n_count; i < s->n_count; i++){ v[i] = v_ramp[i]; }
+	for(int i = 0; i < s->c_count; i++){
+		component_t *c = s->c + i, dc;
+		component_ops_t dc_ops;
+		if(c->linearity == nonlinear){ continue; }
+		if(c->ops->dcLoad != NULL){
+			dc_ops = *c->ops;
+			dc_ops.load = c->ops->dcLoad;
+			dc = *c;
+			dc.ops = &dc_ops;
+			c = &dc;
+		}
+		double i_term[max_terms];
+		stampComponent(s, c, v_ramp, s->e_linear, s->jac_linear, i_term, NULL);
+	}
+	addGmin(s, s->jac_linear, gmin);
+}
+
+// one attempt at the operating point, starting from v
+static int dcNewton(sim_t *s, double *v, double *e, double *jac, double ramp, double gmin){
+	double e_sqmag;
+	int maxiter = s->maxiter;
+	stampDC(s, v, ramp, gmin);
+	if(s->maxiter > op_maxiter){ s->maxiter = op_maxiter; }
+	int r = newton(s, v, e, jac, &e_sqmag);
+	s->maxiter = maxiter;
+	return r > 0;
+}
+
+// the dc operating point, with capacitors open and inductors shorted, is
+// left in v. newton's method is tried on its own first, then with gmin
+// stepped down a decade at a time from op_gmin_start, and then with the
+// fixed voltages ramped up from 0 in steps that shrink when they fail
+static int operatingPoint(sim_t *s, double *v, double *e, double *jac){
+	stats_t before = s->stats;
+	s->v_ramp = arenaAlloc(&s->arena, sizeof(double)*(s->n_count + 1));
+	for(int i = 0; i < s->var_n_count; i++){ v[i] = 0; }
+	int ok = dcNewton(s, v, e, jac, 1, s->gmin);
+	
+	if(!ok){
+		for(int i = 0; i < s->var_n_count; i++){ v[i] = 0; }
+		for(double gmin = fmax(op_gmin_start, s->gmin);;){
+			s->stats.gmin_steps++;
+			if(!dcNewton(s, v, e, jac, 1, gmin)){ break; }
+			if(gmin == s->gmin){ ok = 1; break; }
+			double next = gmin/10;
+			gmin = (next > s->gmin && next > op_gmin_start*1e-12)? next : s->gmin;
+		}
+	}
+	if(!ok){
+		double *v_last = arenaAlloc(&s->arena, sizeof(double)*(s->n_count + 1));
+		double ramp = 0, step = 0.1;
+		for(int i = 0; i < s->var_n_count; i++){ v[i] = 0; }
+		while(ramp < 1 && step > 1e-3){
+			double next = fmin(1, ramp + step);
+			memcpy(v_last, v, sizeof(double)*s->n_count);
+			s->stats.source_steps++;
+			if(dcNewton(s, v, e, jac, next, s->gmin)){
+				ramp = next;
+				step *= 2;
+			} else {
+				memcpy(v, v_last, sizeof(double)*s->n_count);
+				step /= 4;
+			}
+		}
+		ok = (ramp == 1);
+	}
+	
+	// the iterations are counted separately from those of the time steps
+	s->stats.op_iters = s->stats.iters_total - before.iters_total;
+	s->stats.iters_total = before.iters_total;
+	s->stats.iters_min = before.iters_min;
+	s->stats.iters_max = before.iters_max;
+	s->refactor = 1;
+	if(!ok){ return 0; }
+	
+	// the capacitors and inductors take their state from the operating point
+	for(int i = 0; i < s->c_count; i++){
+		component_t *c = s->c + i;
+		if(c->linearity != linear_reactive){ continue; }
+		double v_term[max_terms], i_term[max_terms], j_term[max_terms*max_terms];
+		for(int j = 0; j < c->terminals_count; j++){ v_term[j] = v[c->terminals[j]]; }
+		c->ops->dcLoad(c->parameters, v_term, s->step, i_term, j_term);
+		c->ops->updateState(c->parameters, v_term, s->step, i_term);
+	}
+	return 1;
+}
+
+// set up everything that is worked out once per simulation, and the
+// initial guess of v: variable nodes at 0V, fixed nodes at their voltage
+static void prepare(sim_t *s, double *v){
+	arena_t *a = &s->arena;
+	if(s->chord){
+		s->jac_factored = arenaAlloc(a, sizeof(double)*jacobianSize(s));
+		s->refactor = 1;
+	}
+	if(s->factor_single){
+		s->refine_b = arenaAlloc(a, sizeof(double)*(s->n_count + 1));
+		s->refine_r = arenaAlloc(a, sizeof(double)*(s->n_count + 1));
+	}
+	if(s->table_points > 0 && s->table == NULL){ s->table = satExpTable(a, s->table_points); }
+	// derived constants are worked out again for every simulation,
+	// as the parameters might have been changed since parsing
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c[i].ops->setup != NULL){ s->c[i].ops->setup(s->c[i].parameters); }
+	}
+	s->currents = arenaAlloc(a, sizeof(double)*(s->c_count + 1)*max_terms);
+	// the records only need the measured nodes and components, which have
+	// their voltage and current recorded if they have two terminals
+	s->measured_n = arenaAlloc(a, sizeof(int)*(s->n_count + 1));
+	s->measured_c = arenaAlloc(a, sizeof(int)*(s->c_count + 1));
+	s->measured_n_count = s->measured_c_count = 0;
+	for(int i = 0; i < s->n_count; i++){
+		if(s->n_info[i].is_measured){ s->measured_n[s->measured_n_count++] = i; }
+	}
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c_info[i].is_measured && s->c[i].terminals_count == 2){ s->measured_c[s->measured_c_count++] = i; }
+	}
+	setupLinearStamps(s);
+	setupDeviceGroups(s);
+	if(s->eval_threads > 1 && s->eval_pool == NULL){ s->eval_pool = poolCreate(s->eval_threads); }
+	
+	s->stats.iters_min = s->maxiter;
+	s->stats.step_min = s->stats.step_max = s->timestep;
+	s->step = s->timestep;
+	
+	// assume that nodes are sorted by variable nodes, then fixed nodes
+	for(int i = 0; i < s->n_count; i++){
+		if(!s->n[i].is_fixed){ v[i] = 0; }
+		else { v[i] = s->n[i].fixed_voltage; }
+	}
+	
+	// the first evaluation is limited from the initial guess
+	if(s->limiting){
+		s->v_last = arenaAlloc(a, sizeof(double)*(s->c_count + 1)*max_terms);
+		s->v_last_saved = arenaAlloc(a, sizeof(double)*(s->c_count + 1)*max_terms);
+		for(int i = 0; i < s->c_count; i++){
+			for(int t = 0; t < s->c[i].terminals_count; t++){
+				s->v_last[i*max_terms + t] = v[s->c[i].terminals[t]];
+			}
+		}
+	}
+	if(s->damping == damping_linesearch){
+		s->v_base = arenaAlloc(a, sizeof(double)*(s->n_count + 1));
+		s->newton_step = arenaAlloc(a, sizeof(double)*(s->n_count + 1));
+	}
+	if(s->predictor > 0){
+		s->history = arenaAlloc(a, sizeof(double)*(s->var_n_count + 1)*(max_predictor + 1));
+		s->prediction = arenaAlloc(a, sizeof(double)*(s->n_count + 1));
+		s->e_trial = arenaAlloc(a, sizeof(double)*(s->n_count + 1));
+		s->jac_trial = arenaAlloc(a, sizeof(double)*(jacobianSize(s) + 1));
+		s->currents_saved = arenaAlloc(a, sizeof(double)*(s->c_count + 1)*max_terms);
+		s->v_last_trial = arenaAlloc(a, sizeof(double)*(s->c_count + 1)*max_terms);
+		s->e_start = 0;
+	}
+	s->history_count = 0;
+	s->evaluated = 0;
+}
+
+// set up a run of s from time 0, which starts from the dc operating
+// point if s->op is set, unless it is to be resumed from a checkpoint.
+// the arrays of the run are freed along with s
+int runStart(sim_t *s, run_t *run){
+	arena_t *a = &s->arena;
+	memset(run, 0, sizeof(run_t));
+	run->v = arenaAlloc(a, sizeof(double)*s->n_count);
+	run->e = arenaAlloc(a, sizeof(double)*s->n_count);
+	// the sparse solver keeps its own storage for the non-zeros
+	run->jac = (s->solver == solver_sparse)? s->sparse.values :
+		arenaAlloc(a, sizeof(double)*s->n_count*s->n_count);
+	prepare(s, run->v);
+	
+	run->rec_count = recordSize(s);
+	run->rec = arenaAlloc(a, sizeof(double)*(run->rec_count + 1));
+	run->rec_last = arenaAlloc(a, sizeof(double)*(run->rec_count + 1));
+	run->rec_sample = arenaAlloc(a, sizeof(double)*(run->rec_count + 1));
+	run->v_last = arenaAlloc(a, sizeof(double)*s->n_count);
+	run->sample = run->step = s->timestep;
+	
+	// the transient can start from the operating point, instead of 0V
+	if(s->op && !s->resume && !operatingPoint(s, run->v, run->e, run->jac)){
+		fprintf(stderr, "error: could not find the dc operating point\n");
+		return 0;
+	}
+	return 1;
+}
+
+// after the voltage of a fixed node or the parameters of a component have
+// been changed between steps: the derived constants and the constant stamps
+// are worked out again, the device groups take new copies of the parameters,
+// and the factors kept by chord newton are refreshed
+void simChanged(sim_t *s){
+	for(int i = 0; i < s->c_count; i++){
+		if(s->c[i].ops->setup != NULL){ s->c[i].ops->setup(s->c[i].parameters); }
+	}
+	stampConstant(s);
+	for(int k = 0; k < s->groups_count; k++){
+		device_group_t *g = s->groups + k;
+		for(int n = 0; n < g->count; n++){
+			const double *parameters = s->c[g->components[n]].parameters;
+			for(int p = 0; p < max_params; p++){ g->parameters[p][n] = parameters[p]; }
+		}
+	}
+	s->refactor = 1;
+}
+
+// everything a simulation uses is kept in s, so that
+// copies of the same circuit can be simulated at once
+int simulate(sim_t *s, FILE *f){
+	run_t run;
+	int ok = runStart(s, &run);
+	
+	// the first line will be column labels, unless the output is resumed
+	output_t o;
+	if(ok && (ok = outputOpen(&o, s, f))){
+		if(s->resume){ ok = checkpointLoad(s, &o, &run); }
+		checkpointStart(s);
+		while(ok && !runDone(s, &run)){
+			ok = runStep(s, &run, &o);
+			if(ok && checkpointDue(s)){ checkpointSave(s, &o, &run); }
+		}
+		double t = profileStart(s);
+		checkpointWait(s);
+		ok = outputClose(&o) && ok;
+		checkpointFinish(s, ok);
+		profileLap(s, phase_output, t);
+		if(s->format == format_memory){
+			s->records = o.records;
+			s->records_rows = o.rows;
+		}
+	}
+	if(!ok){
+		return 0;
+	}
+	if(s->quiet){
+		return 1;
+	}
+	
+	fprintf(stderr, "cycles = %i, total iterations = %i\n", s->stats.steps, s->stats.iters_total);
+	fprintf(stderr, "avg iterations/cycle = %.1f\n", (double) s->stats.iters_total/(double) s->stats.steps);
+	fprintf(stderr, "min iterations/cycle = %i\n", s->stats.iters_min);
+	fprintf(stderr, "max iterations/cycle = %i\n", s->stats.iters_max);
+	if(s->op){
+		fprintf(stderr, "operating point: %i iterations, %i gmin steps, %i source steps\n",
+			s->stats.op_iters, s->stats.gmin_steps, s->stats.source_steps);
+	}
+	if(s->predictor > 0){
+		// tries, not steps, since an adaptive step can be retried
+		int other = s->stats.steps + s->stats.rejected_lte + s->stats.rejected_newton - s->stats.predicted;
+		fprintf(stderr, "predictor: %i tries predicted, %i checked against the last solution, %i fell back\n",
+			s->stats.predicted, s->stats.checked, s->stats.fallbacks);
+		fprintf(stderr, "avg iterations/try = %.1f predicted, %.1f not predicted\n",
+			s->stats.predicted? (double) s->stats.iters_predicted/s->stats.predicted : 0.0,
+			other? (double) s->stats.iters_unpredicted/other : 0.0);
+	}
+	if(s->limiting || s->damping == damping_linesearch){
+		fprintf(stderr, "limited evaluations = %i, line search backtracks = %i\n",
+			s->stats.limited, s->stats.backtracks);
+	}
+	if(s->adaptive){
+		fprintf(stderr, "rejected steps = %i (truncation error), %i (not converged)\n",
+			s->stats.rejected_lte, s->stats.rejected_newton);
+		fprintf(stderr, "min step = %.3e, max step = %.3e\n", s->stats.step_min, s->stats.step_max);
+	}
+	if(s->reuse_pivots || s->chord){
+		fprintf(stderr, "factorizations = %i, reused factorizations = %i\n",
+			s->stats.factorizations, s->stats.factor_reuses);
+	}
+	if(s->factor_single){
+		fprintf(stderr, "single precision factors: %i refinements, %i fell back to double\n",
+			s->stats.refinements, s->stats.refine_fallbacks);
+	}
+	if(s->table_points > 0){
+		double value_error, deriv_error;
+		satExpTableError(s->table, &value_error, &deriv_error);
+		fprintf(stderr, "table model: %i points, max error %.2g (current), %.2g (slope)\n",
+			s->table_points, value_error, deriv_error);
+	}
+	if(s->reuse_pivots){
+		fprintf(stderr, "re-pivots = %i (pivottol %.3g)\n", s->stats.repivots, s->pivot_tol);
+	}
+	
+	return 1;
+}
+
+// only the dc operating point, with the voltage of every node written to f
+int simulateOp(sim_t *s, FILE *f){
+	double *v = arenaAlloc(&s->arena, sizeof(double)*s->n_count);
+	double *e = arenaAlloc(&s->arena, sizeof(double)*s->n_count);
+	double *jac = (s->solver == solver_sparse)? s->sparse.values :
+		arenaAlloc(&s->arena, sizeof(double)*s->n_count*s->n_count);
+	prepare(s, v);
+	
+	int ok = operatingPoint(s, v, e, jac);
+	if(ok){
+		fprintf(f, "node, voltage(V)\n");
+		for(int i = 0; i < s->n_count; i++){
+			fprintf(f, "%s, %.*e\n", s->n_info[i].name, s->precision, v[i]);
+		}
+		ok = fflush(f) == 0 && !ferror(f);
+	} else {
+		fprintf(stderr, "error: could not find the dc operating point\n");
+	}
+	if(ok && !s->quiet){
+		fprintf(stderr, "operating point: %i iterations, %i gmin steps, %i source steps\n",
+			s->stats.op_iters, s->stats.gmin_steps, s->stats.source_steps);
+	}
+	return ok;
+}
+
+// make s an independent copy of the circuit in t, which has
+// not been simulated, with its own components and matrix storage
+int simCopy(sim_t *s, const sim_t *t){
+	*s = *t;
+	s->arena.blocks = NULL;
+	s->c = arenaCopy(&s->arena, t->c, sizeof(component_t)*t->c_count);
+	s->n = arenaCopy(&s->arena, t->n, sizeof(node_t)*t->n_count);
+	s->c_info = arenaCopy(&s->arena, t->c_info, sizeof(info_t)*t->c_count);
+	s->n_info = arenaCopy(&s->arena, t->n_info, sizeof(info_t)*t->n_count);
+	// the copy gets its own parameter blocks, shared in the same way
+	s->params = arenaCopy(&s->arena, t->params, sizeof(double)*max_params*t->params_count);
+	for(int i = 0; i < t->c_count; i++){
+		s->c[i].parameters = s->params + (t->c[i].parameters - t->params);
+	}
+	s->jac_factored = NULL;
+	s->refine_b = s->refine_r = NULL;
+	s->jac_const = s->e_const = s->jac_linear = s->e_linear = s->v_fixed = NULL;
+	s->nonlinear = NULL;
+	s->groups = NULL;
+	s->groups_count = 0;
+	s->currents = NULL;
+	s->measured_n = s->measured_c = NULL;
+	s->v_last = s->v_last_saved = NULL;
+	s->v_base = s->newton_step = NULL;
+	s->history = s->prediction = NULL;
+	s->v_ramp = NULL;
+	s->e_trial = s->jac_trial = s->currents_saved = NULL;
+	s->table = NULL;
+	// the runs of a batch are already on threads of their own
+	s->eval_threads = 1;
+	s->eval_pool = NULL;
+	s->bbd = NULL;
+	s->checkpoint_interval = 0;
+	s->resume = 0;
+	s->checkpoint = NULL;
+	s->records = NULL;
+	s->records_rows = 0;
+	memset(&s->stats, 0, sizeof(stats_t));
+	s->profiling = 0;
+	memset(&s->profile, 0, sizeof(profile_t));
+	return matrixSetup(s);
+}
+
+// free everything owned by s, apart from its list of variations. only the
+// matrix storage (whose sparse factors grow with their fill) and the records
+// are allocated on their own, the rest goes with the arena
+void simFree(sim_t *s){
+	matrixFree(s);
+	if(s->eval_pool != NULL){ poolDestroy(s->eval_pool); }
+	s->eval_pool = NULL;
+	free(s->records);
+	s->records = NULL;
+	arenaFree(&s->arena);
+	s->c = NULL; s->n = NULL; s->params = NULL;
+	s->table = NULL;
+	s->c_info = s->n_info = NULL;
+	s->groups = NULL;
+	s->groups_count = 0;
+}
@@ -0,0 +1,597 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#include"circuitsim.h"
+#include<math.h>
+#include<string.h>
+#include<stdlib.h>
+
+// a binary heap of (degree, node) pairs, used by the minimum degree ordering.
+// stale entries are left in the heap and skipped when popped
+typedef struct {
+	int count, space;
+	int *degree, *node;
+} heap_t;
+
+static int heapLess(heap_t *h, int a, int b){
+	return h->degree[a] < h->degree[b] || (h->degree[a] == h->degree[b] && h->node[a] < h->node[b]);
+}
+
+static void heapSwap(heap_t *h, int a, int b){
+	int d = h->degree[a], n = h->node[a];
+	h->degree[a] = h->degree[b], h->node[a] = h->node[b];
+	h->degree[b] = d, h->node[b] = n;
+}
+
+static void heapPush(heap_t *h, int degree, int node){
+	if(h->count == h->space){
+		h->space = 2*h->space + 16;
+		h->degree = realloc(h->degree, sizeof(int)*h->space);
+		h->node = realloc(h->node, sizeof(int)*h->space);
+	}
+	int i = h->count++;
+	h->degree[i] = degree, h->node[i] = node;
+	while(i > 0 && heapLess(h, i, (i - 1)/2)){
+		heapSwap(h, i, (i - 1)/2);
+		i = (i - 1)/2;
+	}
+}
+
+static void heapPop(heap_t *h, int *degree, int *node){
+	*degree = h->degree[0], *node = h->node[0];
+	h->count--;
+	heapSwap(h, 0, h->count);
+	for(int i = 0;;){
+		int l = 2*i + 1, r = 2*i + 2, min = i;
+		if(l < h->count && heapLess(h, l, min)){ min = l; }
+		if(r < h->count && heapLess(h, r, min)){ min = r; }
+		if(min == i){ break; }
+		heapSwap(h, i, min); i = min;
+	}
+}
+
+// minimum degree ordering of a symmetric pattern, by explicit elimination
+// of the node graph. eliminating a node joins all of its neighbours into
+// a clique, which is exactly the fill in that the elimination would cause
+static void minimumDegree(int n, const int *colptr, const int *rowind, int *q){
+	int **adj = malloc(sizeof(int*)*n);
+	int *len = malloc(sizeof(int)*n), *space = malloc(sizeof(int)*n);
+	int *mark = calloc(n, sizeof(int));
+	heap_t h = {0};
+
+	for(int j = 0; j < n; j++){
+		space[j] = colptr[j + 1] - colptr[j] + 4;
+		adj[j] = malloc(sizeof(int)*space[j]);
+		len[j] = 0;
+		for(int p = colptr[j]; p < colptr[j + 1]; p++){
+			if(rowind[p] != j){ adj[j][len[j]++] = rowind[p]; }
+		}
+		heapPush(&h, len[j], j);
+	}
+
+	int stamp = 0;
+	for(int k = 0; k < n;){
+		int degree, p;
+		heapPop(&h, &degree, &p);
+		// skip eliminated nodes and out of date degrees
+		if(len[p] < 0 || len[p] != degree){ continue; }
+		q[k++] = p;
+
+		for(int a = 0; a < len[p]; a++){
+			int u = adj[p][a];
+			stamp++;
+			// remove p from the neighbour, and mark its remaining adjacency
+			for(int b = 0; b < len[u];){
+				if(adj[u][b] == p){ adj[u][b] = adj[u][--len[u]]; }
+				else { mark[adj[u][b++]] = stamp; }
+			}
+			mark[u] = stamp;
+			// then add the rest of p's neighbours as fill
+			for(int b = 0; b < len[p]; b++){
+				int w = adj[p][b];
+				if(mark[w] == stamp){ continue; }
+				if(len[u] == space[u]){
+					space[u] *= 2;
+					adj[u] = realloc(adj[u], sizeof(int)*space[u]);
+				}
+				adj[u][len[u]++] = w;
+			}
+			heapPush(&h, len[u], u);
+		}
+		len[p] = -1;
+	}
+
+	for(int j = 0; j < n; j++){ free(adj[j]); }
+	free(adj); free(len); free(space); free(mark);
+	free(h.degree); free(h.node);
+}
+
+static int compareInt(const void *a, const void *b){
+	return *(const int *) a - *(const int *) b;
+}
+
+// index of an element in the sorted column of the pattern, or -1
+int sparseIndex(const sparse_t *m, int row, int col){
+	int lo = m->colptr[col], hi = m->colptr[col + 1] - 1;
+	while(lo <= hi){
+		int mid = (lo + hi)/2;
+		if(m->rowind[mid] == row){ return mid; }
+		else if(m->rowind[mid] < row){ lo = mid + 1; }
+		else { hi = mid - 1; }
+	}
+	return -1;
+}
+
+int matrixSetup(sim_t *s){
+	int n = s->var_n_count;
+
+	// each component's jacobian elements are together, in component order
+	size_t jac_count = 0;
+	for(int i = 0; i < s->c_count; i++){
+		s->c[i].jac_start = jac_count;
+		jac_count += s->c[i].terminals_count*s->c[i].terminals_count;
+	}
+	s->jac_index = arenaAlloc(&s->arena, sizeof(int)*(jac_count + 1));
+
+	// the dense jacobian is simply row major, with a row length of n_count
+	if(s->solver == solver_dense){
+		for(int i = 0; i < s->c_count; i++){
+			component_t *c = s->c + i;
+			int *index = s->jac_index + c->jac_start;
+			for(int row = 0; row < c->terminals_count; row++){
+				for(int col = 0; col < c->terminals_count; col++){
+					int trow = c->terminals[row], tcol = c->terminals[col];
+					index[row*c->terminals_count + col] =
+						(trow < n && tcol < n)? trow*s->n_count + tcol : -1;
+				}
+			}
+		}
+		denseSetup(&s->dense, n);
+		return 1;
+	}
+
+	// the sparse jacobian has a non-zero for every pair of variable nodes
+	// that share a component, plus the diagonal. first find an upper bound
+	// on the length of each column
+	sparse_t *m = &s->sparse;
+	memset(m, 0, sizeof(sparse_t));
+	m->n = n;
+	m->colptr = malloc(sizeof(int)*(n + 1));
+	int *fill = calloc(n + 1, sizeof(int));
+	for(int j = 0; j < n; j++){ fill[j] = 1; }
+	for(int i = 0; i < s->c_count; i++){
+		for(int col = 0; col < s->c[i].terminals_count; col++){
+			int tcol = s->c[i].terminals[col];
+			if(tcol < n){ fill[tcol] += s->c[i].terminals_count - 1; }
+		}
+	}
+	m->colptr[0] = 0;
+	for(int j = 0; j < n; j++){ m->colptr[j + 1] = m->colptr[j] + fill[j]; }
+	int *rows = malloc(sizeof(int)*(m->colptr[n] + 1));
+
+	// then collect rows, duplicates are removed once each column is sorted
+	for(int j = 0; j < n; j++){
+		rows[m->colptr[j]] = j;
+		fill[j] = 1;
+	}
+	for(int i = 0; i < s->c_count; i++){
+		component_t *c = s->c + i;
+		for(int col = 0; col < c->terminals_count; col++){
+			int tcol = c->terminals[col];
+			if(tcol >= n){ continue; }
+			for(int row = 0; row < c->terminals_count; row++){
+				int trow = c->terminals[row];
+				if(trow >= n || trow == tcol){ continue; }
+				rows[m->colptr[tcol] + fill[tcol]++] = trow;
+			}
+		}
+	}
+
+	// compress the columns
+	m->rowind = malloc(sizeof(int)*(m->colptr[n] + 1));
+	int nnz = 0;
+	for(int j = 0; j < n; j++){
+		int *start = rows + m->colptr[j];
+		qsort(start, fill[j], sizeof(int), compareInt);
+		m->colptr[j] = nnz;
+		for(int k = 0; k < fill[j]; k++){
+			if(k == 0 || start[k] != start[k - 1]){ m->rowind[nnz++] = start[k]; }
+		}
+	}
+	m->colptr[n] = nnz;
+	m->nnz = nnz;
+	m->values = malloc(sizeof(double)*(nnz + 1));
+	free(rows); free(fill);
+
+	for(int i = 0; i < s->c_count; i++){
+		component_t *c = s->c + i;
+		int *index = s->jac_index + c->jac_start;
+		for(int row = 0; row < c->terminals_count; row++){
+			for(int col = 0; col < c->terminals_count; col++){
+				int trow = c->terminals[row], tcol = c->terminals[col];
+				index[row*c->terminals_count + col] =
+					(trow < n && tcol < n)? sparseIndex(m, trow, tcol) : -1;
+			}
+		}
+	}
+	sparsePrepare(m);
+	
+	// large circuits can be split in to blocks that are factorized in parallel
+	if(s->partitions > 1){ bbdSetup(s); }
+	return 1;
+}
+
+// the fill reducing ordering and the storage for the factors,
+// once the pattern of m is filled in
+void sparsePrepare(sparse_t *m){
+	int n = m->n, nnz = m->nnz;
+	m->q = malloc(sizeof(int)*(n + 1));
+	minimumDegree(n, m->colptr, m->rowind, m->q);
+
+	m->pinv = malloc(sizeof(int)*(n + 1));
+	m->x = malloc(sizeof(double)*(n + 1));
+	m->xi = malloc(sizeof(int)*(2*n + 1));
+	m->mark = calloc(n + 1, sizeof(int));
+	m->l_space = m->u_space = 4*nnz + n;
+	m->l_colptr = malloc(sizeof(int)*(n + 1));
+	m->u_colptr = malloc(sizeof(int)*(n + 1));
+	m->l_rowind = malloc(sizeof(int)*m->l_space);
+	m->u_rowind = malloc(sizeof(int)*m->u_space);
+	m->l_values = malloc(sizeof(double)*m->l_space);
+	m->u_values = malloc(sizeof(double)*m->u_space);
+	m->factored = 0;
+}
+
+// an n by n matrix with a non-zero at each of the count (row, col) pairs,
+// which can be repeated, and along the diagonal
+void sparseBuild(sparse_t *m, int n, int count, const int *rows, const int *cols){
+	memset(m, 0, sizeof(sparse_t));
+	m->n = n;
+	m->colptr = calloc(n + 1, sizeof(int));
+	for(int k = 0; k < count; k++){ m->colptr[cols[k] + 1]++; }
+	for(int j = 0; j < n; j++){ m->colptr[j + 1] += m->colptr[j] + 1; }
+	int *all = malloc(sizeof(int)*(m->colptr[n] + 1)), *fill = malloc(sizeof(int)*(n + 1));
+	for(int j = 0; j < n; j++){
+		all[m->colptr[j]] = j;
+		fill[j] = 1;
+	}
+	for(int k = 0; k < count; k++){ all[m->colptr[cols[k]] + fill[cols[k]]++] = rows[k]; }
+	
+	m->rowind = malloc(sizeof(int)*(m->colptr[n] + 1));
+	int nnz = 0;
+	for(int j = 0; j < n; j++){
+		int *start = all + m->colptr[j];
+		qsort(start, fill[j], sizeof(int), compareInt);
+		m->colptr[j] = nnz;
+		for(int k = 0; k < fill[j]; k++){
+			if(k == 0 || start[k] != start[k - 1]){ m->rowind[nnz++] = start[k]; }
+		}
+	}
+	m->colptr[n] = nnz;
+	m->nnz = nnz;
+	m->values = calloc(nnz + 1, sizeof(double));
+	free(all); free(fill);
+	sparsePrepare(m);
+}
+
+void sparseRelease(sparse_t *m){
+	free(m->colptr); free(m->rowind); free(m->values);
+	free(m->q); free(m->pinv);
+	free(m->x); free(m->xi); free(m->mark);
+	free(m->l_colptr); free(m->l_rowind); free(m->l_values);
+	free(m->u_colptr); free(m->u_rowind); free(m->u_values);
+	free(m->l_single); free(m->u_single); free(m->x_single);
+	memset(m, 0, sizeof(sparse_t));
+}
+
+// free the storage made by matrixSetup
+void matrixFree(sim_t *s){
+	if(s->solver == solver_dense){
+		free(s->dense.lu); free(s->dense.y);
+		free(s->dense.rowperm); free(s->dense.colperm);
+		free(s->dense.lu_single);
+		memset(&s->dense, 0, sizeof(dense_t));
+		return;
+	}
+	if(s->bbd != NULL){ bbdFree(s); }
+	sparseRelease(&s->sparse);
+}
+
+// depth first search of the graph of L starting at row j. rows that are
+// not yet pivotal have no out edges. nodes are pushed on to the output
+// stack xi in topological order once all of their successors are done
+static int reachDFS(sparse_t *m, int j, int top, int *xi, int *pstack){
+	int head = 0;
+	xi[0] = j;
+	while(head >= 0){
+		j = xi[head];
+		int jnew = m->pinv[j];
+		if(!m->mark[j]){
+			m->mark[j] = 1;
+			pstack[head] = (jnew < 0)? 0 : m->l_colptr[jnew];
+		}
+		int done = 1, end = (jnew < 0)? 0 : m->l_colptr[jnew + 1];
+		for(int p = pstack[head]; p < end; p++){
+			int i = m->l_rowind[p];
+			if(m->mark[i]){ continue; }
+			pstack[head] = p;
+			xi[++head] = i;
+			done = 0;
+			break;
+		}
+		if(done){ head--; xi[--top] = j; }
+	}
+	return top;
+}
+
+// x = L\A(:,col), where only the pattern reachable from A(:,col) is touched.
+// the pattern of x is returned in xi[top..n-1]
+static int sparseTriangular(sparse_t *m, int col){
+	int n = m->n, top = n;
+	for(int p = m->colptr[col]; p < m->colptr[col + 1]; p++){
+		if(!m->mark[m->rowind[p]]){ top = reachDFS(m, m->rowind[p], top, m->xi, m->xi + n); }
+	}
+	for(int p = top; p < n; p++){ m->mark[m->xi[p]] = 0; m->x[m->xi[p]] = 0; }
+	for(int p = m->colptr[col]; p < m->colptr[col + 1]; p++){
+		m->x[m->rowind[p]] = m->values[p];
+	}
+	for(int px = top; px < n; px++){
+		int j = m->xi[px], jnew = m->pinv[j];
+		if(jnew < 0){ continue; }
+		// L has a unit diagonal as the first element in each column
+		for(int p = m->l_colptr[jnew] + 1; p < m->l_colptr[jnew + 1]; p++){
+			m->x[m->l_rowind[p]] -= m->l_values[p]*m->x[j];
+		}
+	}
+	return top;
+}
+
+static void growFactor(int **rowind, double **values, int *space, int needed){
+	if(needed <= *space){ return; }
+	*space = 2*needed;
+	*rowind = realloc(*rowind, sizeof(int)*(*space));
+	*values = realloc(*values, sizeof(double)*(*space));
+}
+
+// left looking lu factorization with threshold partial pivoting (gilbert-peierls),
+// with columns taken in the fill reducing order. returns 0 if singular
+int sparseFactor(sparse_t *m){
+	int n = m->n, lnz = 0, unz = 0;
+	m->factored = m->single = 0;
+	for(int i = 0; i < n; i++){ m->pinv[i] = -1; m->mark[i] = 0; }
+
+	for(int k = 0; k < n; k++){
+		// make sure there is room for another full column
+		growFactor(&m->l_rowind, &m->l_values, &m->l_space, lnz + n);
+		growFactor(&m->u_rowind, &m->u_values, &m->u_space, unz + n);
+		m->l_colptr[k] = lnz;
+		m->u_colptr[k] = unz;
+
+		int col = m->q[k];
+		int top = sparseTriangular(m, col);
+
+		// search for the largest non-pivotal element in the column,
+		// while moving the pivotal elements in to U
+		int ipiv = -1;
+		double a = -1;
+		for(int p = top; p < n; p++){
+			int i = m->xi[p];
+			if(m->pinv[i] < 0){
+				if(fabs(m->x[i]) > a){ a = fabs(m->x[i]); ipiv = i; }
+			} else {
+				m->u_rowind[unz] = m->pinv[i];
+				m->u_values[unz++] = m->x[i];
+			}
+		}
+		if(ipiv < 0 || a <= 0){ return 0; }
+		// but prefer the diagonal, which is what the ordering was made for
+		if(m->pinv[col] < 0 && fabs(m->x[col]) >= a*sparse_pivot_tol){ ipiv = col; }
+
+		double pivot = m->x[ipiv];
+		m->u_rowind[unz] = k;
+		m->u_values[unz++] = pivot;
+		m->pinv[ipiv] = k;
+		m->l_rowind[lnz] = ipiv;
+		m->l_values[lnz++] = 1;
+		for(int p = top; p < n; p++){
+			int i = m->xi[p];
+			if(m->pinv[i] < 0){
+				m->l_rowind[lnz] = i;
+				m->l_values[lnz++] = m->x[i]/pivot;
+			}
+			m->x[i] = 0;
+		}
+	}
+	m->l_colptr[n] = lnz;
+	m->u_colptr[n] = unz;
+	// L was built with original row indices, make them pivot rows
+	for(int p = 0; p < lnz; p++){ m->l_rowind[p] = m->pinv[m->l_rowind[p]]; }
+	m->factored = 1;
+	return 1;
+}
+
+// numerical factorization reusing the pivot order and the patterns of L and U
+// from the last call to sparseFactor, so no graph search is needed. the
+// elements of U in each column are stored in topological order, so they can
+// be eliminated in the stored order. returns -1 if a pivot has become too
+// small compared to the rest of its column, and a fresh factorization is needed
+int sparseRefactor(sparse_t *m, double pivot_tol){
+	int n = m->n;
+	double *x = m->x;
+	m->single = 0;
+	for(int k = 0; k < n; k++){
+		int col = m->q[k];
+		for(int p = m->colptr[col]; p < m->colptr[col + 1]; p++){
+			x[m->pinv[m->rowind[p]]] = m->values[p];
+		}
+		int udiag = m->u_colptr[k + 1] - 1;
+		for(int p = m->u_colptr[k]; p < udiag; p++){
+			int j = m->u_rowind[p];
+			double xj = x[j];
+			m->u_values[p] = xj;
+			x[j] = 0;
+			for(int pl = m->l_colptr[j] + 1; pl < m->l_colptr[j + 1]; pl++){
+				x[m->l_rowind[pl]] -= m->l_values[pl]*xj;
+			}
+		}
+
+		double pivot = x[k], col_max = 0;
+		x[k] = 0;
+		for(int p = m->l_colptr[k] + 1; p < m->l_colptr[k + 1]; p++){
+			double mag = fabs(x[m->l_rowind[p]]);
+			if(mag > col_max){ col_max = mag; }
+		}
+		if(pivot == 0 || fabs(pivot) < pivot_tol*col_max){
+			for(int p = m->l_colptr[k] + 1; p < m->l_colptr[k + 1]; p++){ x[m->l_rowind[p]] = 0; }
+			m->factored = 0;
+			return -1;
+		}
+		m->u_values[udiag] = pivot;
+		for(int p = m->l_colptr[k] + 1; p < m->l_colptr[k + 1]; p++){
+			m->l_values[p] = x[m->l_rowind[p]]/pivot;
+			x[m->l_rowind[p]] = 0;
+		}
+	}
+	return 1;
+}
+
+// sparseRefactor in single precision, in to l_single and u_single, which
+// must follow a successful sparseFactor. it returns -1 in the same way,
+// and 0 if the factors do not fit in single precision
+int sparseRefactorSingle(sparse_t *m, double pivot_tol){
+	int n = m->n, lnz = m->l_colptr[n], unz = m->u_colptr[n];
+	m->single = 0;
+	int needed = (lnz > unz)? lnz : unz;
+	if(needed > m->single_space){
+		m->single_space = needed;
+		m->l_single = realloc(m->l_single, sizeof(float)*needed);
+		m->u_single = realloc(m->u_single, sizeof(float)*needed);
+	}
+	if(m->x_single == NULL){ m->x_single = calloc(n + 1, sizeof(float)); }
+	float *x = m->x_single;
+	for(int k = 0; k < n; k++){
+		int col = m->q[k];
+		for(int p = m->colptr[col]; p < m->colptr[col + 1]; p++){
+			x[m->pinv[m->rowind[p]]] = m->values[p];
+		}
+		int udiag = m->u_colptr[k + 1] - 1;
+		for(int p = m->u_colptr[k]; p < udiag; p++){
+			int j = m->u_rowind[p];
+			float xj = x[j];
+			m->u_single[p] = xj;
+			x[j] = 0;
+			for(int pl = m->l_colptr[j] + 1; pl < m->l_colptr[j + 1]; pl++){
+				x[m->l_rowind[pl]] -= m->l_single[pl]*xj;
+			}
+		}
+
+		float pivot = x[k], col_max = 0;
+		x[k] = 0;
+		for(int p = m->l_colptr[k] + 1; p < m->l_colptr[k + 1]; p++){
+			float mag = fabsf(x[m->l_rowind[p]]);
+			if(mag > col_max){ col_max = mag; }
+		}
+		int r = (!isfinite(pivot) || !isfinite(col_max))? 0 :
+			(pivot == 0 || fabsf(pivot) < pivot_tol*col_max)? -1 : 1;
+		if(r <= 0){
+			for(int p = m->l_colptr[k] + 1; p < m->l_colptr[k + 1]; p++){ x[m->l_rowind[p]] = 0; }
+			return r;
+		}
+		m->u_single[udiag] = pivot;
+		for(int p = m->l_colptr[k] + 1; p < m->l_colptr[k + 1]; p++){
+			m->l_single[p] = x[m->l_rowind[p]]/pivot;
+			x[m->l_rowind[p]] = 0;
+		}
+	}
+	m->single = 1;
+	return 1;
+}
+
+// floating point operations of a refactorization and of a solve with the
+// current factors. each element of U above the diagonal updates a column of L
+void sparseFlops(const sparse_t *m, double *factor, double *solve){
+	int n = m->n;
+	double f = 0;
+	for(int k = 0; k < n; k++){
+		for(int p = m->u_colptr[k]; p < m->u_colptr[k + 1] - 1; p++){
+			int j = m->u_rowind[p];
+			f += 2*(m->l_colptr[j + 1] - m->l_colptr[j] - 1);
+		}
+		f += m->l_colptr[k + 1] - m->l_colptr[k] - 1;
+	}
+	*factor = f;
+	*solve = 2.0*(m->l_colptr[n] - n) + 2.0*(m->u_colptr[n] - n) + n;
+}
+
+// solve A x = b using the lu factors, result is stored in b
+void sparseSolve(sparse_t *m, double *b){
+	int n = m->n;
+	double *x = m->x;
+	for(int i = 0; i < n; i++){ x[m->pinv[i]] = b[i]; }
+	// zeros are skipped, which saves most of the work when b is sparse
+	for(int j = 0; j < n; j++){
+		if(x[j] == 0){ continue; }
+		for(int p = m->l_colptr[j] + 1; p < m->l_colptr[j + 1]; p++){
+			x[m->l_rowind[p]] -= m->l_values[p]*x[j];
+		}
+	}
+	for(int j = n - 1; j >= 0; j--){
+		if(x[j] == 0){ continue; }
+		x[j] /= m->u_values[m->u_colptr[j + 1] - 1];
+		for(int p = m->u_colptr[j]; p < m->u_colptr[j + 1] - 1; p++){
+			x[m->u_rowind[p]] -= m->u_values[p]*x[j];
+		}
+	}
+	for(int k = 0; k < n; k++){ b[m->q[k]] = x[k]; }
+	for(int i = 0; i < n; i++){ x[i] = 0; }
+}
+
+// sparseSolve for a b that is zero in every row pivoted before first, where
+// only the unknowns ordered from first on are wanted. the substitutions
+// start and stop at first, and the rest of b is left as 0
+void sparseSolveFrom(sparse_t *m, double *b, int first){
+	int n = m->n;
+	double *x = m->x;
+	for(int i = 0; i < n; i++){ x[m->pinv[i]] = b[i]; }
+	for(int j = first; j < n; j++){
+		if(x[j] == 0){ continue; }
+		for(int p = m->l_colptr[j] + 1; p < m->l_colptr[j + 1]; p++){
+			x[m->l_rowind[p]] -= m->l_values[p]*x[j];
+		}
+	}
+	for(int j = n - 1; j >= first; j--){
+		if(x[j] == 0){ continue; }
+		x[j] /= m->u_values[m->u_colptr[j + 1] - 1];
+		for(int p = m->u_colptr[j]; p < m->u_colptr[j + 1] - 1; p++){
+			x[m->u_rowind[p]] -= m->u_values[p]*x[j];
+		}
+	}
+	for(int k = 0; k < first; k++){ b[m->q[k]] = 0; }
+	for(int k = first; k < n; k++){ b[m->q[k]] = x[k]; }
+	for(int i = 0; i < n; i++){ x[i] = 0; }
+}
+
+// sparseSolve with the single precision factors, where the
+// substitution itself is still carried out in double precision
+void sparseSolveSingle(sparse_t *m, double *b){
+	int n = m->n;
+	double *x = m->x;
+	for(int i = 0; i < n; i++){ x[m->pinv[i]] = b[i]; }
+	for(int j = 0; j < n; j++){
+		if(x[j] == 0){ continue; }
+		for(int p = m->l_colptr[j] + 1; p < m->l_colptr[j + 1]; p++){
+			x[m->l_rowind[p]] -= m->l_single[p]*x[j];
+		}
+	}
+	for(int j = n - 1; j >= 0; j--){
+		if(x[j] == 0){ continue; }
+		x[j] /= m->u_single[m->u_colptr[j + 1] - 1];
+		for(int p = m->u_colptr[j]; p < m->u_colptr[j + 1] - 1; p++){
+			x[m->u_rowind[p]] -= m->u_single[p]*x[j];
+		}
+	}
+	for(int k = 0; k < n; k++){ b[m->q[k]] = x[k]; }
+	for(int i = 0; i < n; i++){ x[i] = 0; }
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# runs the circuits written by netgen at increasing sizes, and writes a row
+# for each run to bench/results_<version>.csv, so that the files of two
+# versions can be compared line by line:
+# sh tools/bench.sh [path to circuitsim] [path to netgen]
+# BENCH_STEPS sets the number of time steps of every run (default 500), and
+# BENCH_MAX leaves out the sizes larger than that, for a quicker run
+sim=${1:-./circuitsim}
+gen=${2:-./netgen}
+steps=${BENCH_STEPS:-500}
+max=${BENCH_MAX:-1000000}
+
+version=$(git describe --always --dirty 2>/dev/null || echo unknown)
+mkdir -p bench
+out=bench/results_$version.csv
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# a number from the json report, and the seconds spent in one of its phases
+field(){ sed -n "s/.*\"$1\": \([0-9.e+-]*\).*/\1/p" "$work/report.json" | head -n 1; }
+phase(){ sed -n "s/.*\"$1\": {\"seconds\": \([0-9.e+-]*\).*/\1/p" "$work/report.json" | head -n 1; }
+
+# seconds is the whole run, and parse_seconds the part of it spent reading
+# the .conf file. the throughput is over the rest, the simulation itself
+echo "version, circuit, size, nodes, components, steps, iterations, seconds, parse_seconds, peak_memory_kb, throughput(steps.nodes/s)" | tee "$out"
+run(){
+	kind=$1; shift
+	for size in "$@"; do
+		if [ "$size" -gt "$max" ]; then continue; fi
+		"$gen" "$kind" "$size" "$steps" > "$work/circuit.conf" || exit 1
+		if ! "$sim" "$work/circuit.conf" "$work/out.csv" --report "$work/report.json" 2> "$work/log"; then
+			echo "$kind $size failed:" >&2; cat "$work/log" >&2
+			continue
+		fi
+		echo "$version, $kind, $size, $(field nodes), $(field components), $(field steps), $(field iterations), $(field total_seconds), $(phase parse), $(field peak_memory_kb)" |
+			awk -F', ' '{ printf "%s, %.4g\n", $0, ($8 > $9)? $6*$4/($8 - $9) : 0 }' | tee -a "$out"
+	done
+}
+
+# the largest rc ladder has a million components
+run rc 100 1000 10000 100000 500000
+run rlc 100 1000 10000
+run lc 100 1000 10000
+run mesh 10 30 100
+run astable 1 10 100 1000
+run bridge 1 10 100 1000
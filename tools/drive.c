@@ -0,0 +1,112 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+// an example of circuitsim used as a library, which also checks that
+// libcircuitsim.h and the library build work together. with no arguments
+// it builds an rc low pass filter in memory, drives it with a sine wave
+// a step at a time, and compares the gain with the one expected. given a
+// .conf file it runs copies of the circuit, changing the voltage of a fixed
+// node for each, and prints the final voltage of another node.
+// compile like this, or with "make drive":
+// make lib && gcc tools/drive.c libcircuitsim.a -o drive -lm -lpthread
+
+#include"../libcircuitsim.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+
+#define pi 3.14159265358979323846
+
+static int filter(void){
+	const double r = 1e3, c = 1e-6, f = 500;
+	const char *settings = "timestep 10u\nendtime 40m\n";
+	circuit_t *k = circuitNew(settings, strlen(settings));
+	if(k == NULL){ return 0; }
+	circuitAddNode(k, "in"); circuitAddNode(k, "out"); circuitAddNode(k, "gnd");
+	circuitSetFixed(k, "in", 0);
+	circuitSetFixed(k, "gnd", 0);
+	circuitAddComponent(k, "res", "R1", (const char *[]){"in", "out"}, (double []){r});
+	circuitAddComponent(k, "cap", "C1", (const char *[]){"out", "gnd"}, (double []){c, 0});
+	if(!circuitFinish(k) || !circuitStart(k)){
+		circuitFree(k);
+		return 0;
+	}
+
+	int in = circuitNode(k, "in"), out = circuitNode(k, "out");
+	const double *v = circuitVoltages(k);
+	// the peak of the output once the filter has settled, after 10 cycles
+	double peak = 0;
+	while(circuitStep(k, 1) == 1){
+		double t = circuitTime(k);
+		circuitSetVoltage(k, in, sin(2*pi*f*t));
+		if(t > 10/f && fabs(v[out]) > peak){ peak = fabs(v[out]); }
+	}
+	circuitFree(k);
+
+	double expected = 1/sqrt(1 + pow(2*pi*f*r*c, 2));
+	printf("rc filter at %g Hz: gain %.4f, expected %.4f\n", f, peak, expected);
+	// a time step of 1/200 of a cycle is good to better than a percent
+	return fabs(peak - expected) < 0.01*expected;
+}
+
+static char *readFile(const char *path, size_t *len){
+	FILE *f = fopen(path, "rb");
+	if(f == NULL){ return NULL; }
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	rewind(f);
+	char *text = malloc(*len);
+	if(fread(text, 1, *len, f) != *len){
+		free(text);
+		text = NULL;
+	}
+	fclose(f);
+	return text;
+}
+
+static int sweep(const char *path, const char *fixed, const char *node, double from, double to, int runs){
+	size_t len;
+	char *text = readFile(path, &len);
+	if(text == NULL){
+		fprintf(stderr, "error: can not read \"%s\"\n", path);
+		return 0;
+	}
+	circuit_t *k = circuitLoad(text, len);
+	free(text);
+	if(k == NULL){ return 0; }
+	int set = circuitNode(k, fixed), measured = circuitNode(k, node);
+	if(set < 0 || measured < 0){
+		fprintf(stderr, "error: no node \"%s\"\n", (set < 0)? fixed : node);
+		circuitFree(k);
+		return 0;
+	}
+
+	// the circuit is only parsed once, and copied for each run
+	int ok = 1;
+	for(int i = 0; i < runs && ok; i++){
+		double voltage = (runs > 1)? from + (to - from)*i/(runs - 1) : from;
+		circuit_t *run = circuitCopy(k);
+		ok = run != NULL && circuitSetVoltage(run, set, voltage) && circuitStart(run);
+		int taken = 1;
+		while(ok && taken > 0){
+			taken = circuitStep(run, 1000);
+			ok = taken >= 0;
+		}
+		if(ok){ printf("%s = %g: %s = %g\n", fixed, voltage, node, circuitVoltages(run)[measured]); }
+		circuitFree(run);
+	}
+	circuitFree(k);
+	return ok;
+}
+
+int main(int argc, char **argv){
+	if(argc == 1){ return filter()? 0 : 1; }
+	if(argc != 7){
+		fprintf(stderr, "usage: drive [file.conf fixed_node node from to runs]\n");
+		return 1;
+	}
+	return sweep(argv[1], argv[2], argv[3], atof(argv[4]), atof(argv[5]), atoi(argv[6]))? 0 : 1;
+}
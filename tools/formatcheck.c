@@ -0,0 +1,94 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+// checks that formatValue, which writes every value of the .csv output,
+// gives exactly what sprintf's %.*e gives, at every precision. the values
+// are the awkward ones (zeros, infinities, nans, subnormals, the ends of
+// the range, values that round up in to the next power of ten, and values
+// on or next to a rounding boundary) and a few million random ones.
+// exits with 1 if any differ. compile like this, or run "make check":
+// make lib && gcc tools/formatcheck.c libcircuitsim.a -o formatcheck -lm -lpthread
+
+#include"../circuitsim.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include<float.h>
+#include<math.h>
+
+#define max_precision 16
+#define max_failures 20
+
+static long checked, failed;
+
+static void check(double x){
+	char expected[64], got[64];
+	for(int precision = 0; precision <= max_precision; precision++){
+		int length = sprintf(expected, "%.*e", precision, x);
+		int written = formatValue(got, x, precision);
+		got[written] = '\0';
+		checked++;
+		if(written != length || strcmp(got, expected) != 0){
+			if(failed++ < max_failures){
+				printf("%.17g at precision %i: \"%s\", sprintf gives \"%s\"\n", x, precision, got, expected);
+			}
+		}
+	}
+}
+
+// x and its neighbours, either sign
+static void checkAround(double x){
+	double values[] = {x, nextafter(x, INFINITY), nextafter(x, -INFINITY)};
+	for(int i = 0; i < 3; i++){
+		check(values[i]);
+		check(-values[i]);
+	}
+}
+
+// a random 64 bit number, from xorshift
+static uint64_t state = 88172645463325252ull;
+static uint64_t next(void){
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+int main(void){
+	double special[] = {
+		0, INFINITY, NAN, DBL_MAX, DBL_MIN, DBL_EPSILON,
+		DBL_TRUE_MIN, 1e-310, 2.5e-320, 1e-290, 1.0000000000000001e-290, 9.99e-291,
+		1, 0.5, 0.25, 0.125, 1.5, 2.5, 0.95, 9.5, 99.5, 0.05,
+		9.9999995e9, 9.99999995e-5, 9.999999999999999e22, 999999.5, 1e22, 1e23
+	};
+	for(size_t i = 0; i < sizeof(special)/sizeof(special[0]); i++){ checkAround(special[i]); }
+
+	// values just below a power of ten, which round up in to the next one at
+	// every precision below their own, and values that end in exactly 5
+	for(int e = -307; e <= 307; e++){
+		for(int digits = 1; digits <= 17; digits++){
+			double nines = (pow(10, digits) - 1)/pow(10, digits - 1);
+			checkAround(nines*pow(10, e));
+			checkAround((nines - 4/pow(10, digits - 1))*pow(10, e));
+		}
+	}
+
+	// a few decimal digits, which is what most simulated values look like
+	for(int i = 0; i < 200000; i++){
+		double mantissa = (double) (next()%100000000)/1e7;
+		checkAround(mantissa*pow(10, (int) (next()%80) - 40));
+	}
+	// any bit pattern at all
+	for(int i = 0; i < 200000; i++){
+		uint64_t bits = next();
+		double x;
+		memcpy(&x, &bits, sizeof(x));
+		check(x);
+	}
+
+	printf("%ld of %ld formatted values differ from sprintf\n", failed, checked);
+	return failed > 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+// writes synthetic circuits of any size, for benchmarking. compile like this:
+// gcc tools/netgen.c -o netgen
+// ./netgen mesh 100 500 > mesh100.conf
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+// the time step and number of steps go first, every circuit uses the sparse solver
+static void header(double timestep, int steps, int convrate){
+	printf("timestep\t%g\nendtime\t\t%g\nconvrate\t%i\nsolver\t\tsparse\n\n", timestep, timestep*steps, convrate);
+}
+
+// a chain of resistors from a 5V source, with a capacitor to ground at each node
+static void rcLadder(int n){
+	printf("nodes\t\tvs gnd\nset\t\t\tgnd 0 vs 5\n\n");
+	for(int i = 0; i < n; i++){
+		printf("nodes\t\tn%i\n", i);
+		if(i == 0){ printf("res R0\t\tvs n0\t\t100\n"); }
+		else { printf("res R%i\t\tn%i n%i\t\t100\n", i, i - 1, i); }
+		printf("cap C%i\t\tn%i gnd\t\t10n 0\n", i, i);
+	}
+	printf("\nmeasure\t\tn%i\n", n - 1);
+}
+
+// the same, with an inductor in series with each resistor
+static void rlcLadder(int n){
+	printf("nodes\t\tvs gnd\nset\t\t\tgnd 0 vs 5\n\n");
+	for(int i = 0; i < n; i++){
+		printf("nodes\t\tm%i n%i\n", i, i);
+		if(i == 0){ printf("res R0\t\tvs m0\t\t10\n"); }
+		else { printf("res R%i\t\tn%i m%i\t\t10\n", i, i - 1, i); }
+		printf("ind L%i\t\tm%i n%i\t\t10u 0\n", i, i, i);
+		printf("cap C%i\t\tn%i gnd\t\t100n 0\n", i, i);
+	}
+	printf("\nmeasure\t\tn%i\n", n - 1);
+}
+
+// a square grid of resistors with a capacitor at every node, fed from one
+// corner, and a diode to ground at every seventh node
+static void mesh(int n){
+	printf("nodes\t\tvs gnd\nset\t\t\tgnd 0 vs 5\nres Rin\t\tvs n0_0\t\t10\n\n");
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			printf("nodes\t\tn%i_%i\n", i, j);
+			if(i + 1 < n){ printf("res Rx%i_%i\tn%i_%i n%i_%i\t100\n", i, j, i, j, i + 1, j); }
+			if(j + 1 < n){ printf("res Ry%i_%i\tn%i_%i n%i_%i\t100\n", i, j, i, j, i, j + 1); }
+			printf("cap C%i_%i\tn%i_%i gnd\t1u 0\n", i, j, i, j);
+			if((i + j)%7 == 0){ printf("dio D%i_%i\tn%i_%i gnd\t0.66 5m 25n\n", i, j, i, j); }
+		}
+	}
+	printf("\nmeasure\t\tn%i_%i\n", n - 1, n - 1);
+}
+
+// tanks of slightly different frequencies, each coupled to the next, with
+// the first one charged, like LC_coupling_test.conf
+static void lcBank(int n){
+	printf("nodes\t\tgnd\nset\t\t\tgnd 0\n\n");
+	for(int i = 0; i < n; i++){
+		double value = 10 + 0.2*(i%10);
+		printf("nodes\t\tt%i\n", i);
+		printf("cap C%i\t\tt%i gnd\t\t%gu %g\n", i, i, value, (i == 0)? 1.0 : 0.0);
+		printf("ind L%i\t\tt%i gnd\t\t%gu 0\n", i, i, value);
+		if(i > 0){ printf("cap Cc%i\t\tt%i t%i\t\t200n 0\n", i, i - 1, i); }
+	}
+	printf("\nmeasure\t\tt0 t%i\n", n - 1);
+}
+
+// copies of astable_multivib.conf sharing a supply
+static void astables(int n){
+	printf("subckt\t\tastable vcc\n");
+	printf("nodes\t\tvb1 vc1 vb2 vc2\n");
+	printf("res R1\t\tvcc vc1\t\t300\nres R2\t\tvcc vb2\t\t1000\n");
+	printf("res R3\t\tvcc vb1\t\t1000\nres R4\t\tvcc vc2\t\t300\n");
+	printf("cap C1\t\tvc1 vb2\t\t18u 3.5\ncap C2\t\tvc2 vb1\t\t18u -0.5\n");
+	printf("bjt Q1\t\tvc1 vb1 gnd\t100 660m 2m 15n\n");
+	printf("bjt Q2\t\tvc2 vb2 gnd\t100 660m 2m 15n\n");
+	printf("ends\n\n");
+	printf("nodes\t\tvcc gnd\nset\t\t\tgnd 0 vcc 5\n\n");
+	for(int i = 0; i < n; i++){ printf("astable A%i\tvcc\n", i); }
+	printf("\nmeasure\t\tA0.vc1\n");
+}
+
+// full wave rectifiers, each fed by a charged tank, in to an rc load.
+// the tank is held near ground by large resistors
+static void bridges(int n){
+	printf("subckt\t\tbridge\n");
+	printf("nodes\t\ta b out\n");
+	printf("cap Ct\t\ta b\t\t\t10u 10\nind Lt\t\ta b\t\t\t1m 0\n");
+	printf("dio D1\t\ta out\t\t0.66 5m 25n\ndio D2\t\tb out\t\t0.66 5m 25n\n");
+	printf("dio D3\t\tgnd a\t\t0.66 5m 25n\ndio D4\t\tgnd b\t\t0.66 5m 25n\n");
+	printf("res Rl\t\tout gnd\t\t1k\ncap Cl\t\tout gnd\t\t1u 0\n");
+	printf("res Ra\t\ta gnd\t\t1M\nres Rb\t\tb gnd\t\t1M\n");
+	printf("ends\n\n");
+	printf("nodes\t\tgnd\nset\t\t\tgnd 0\n\n");
+	for(int i = 0; i < n; i++){ printf("bridge B%i\n", i); }
+	printf("\nmeasure\t\tB0.out\n");
+}
+
+typedef struct {
+	const char *name;
+	void (*write)(int size);
+	double timestep;
+	// newton steps are damped to this percentage where there are junctions
+	int convrate;
+	const char *size;
+} kind_t;
+
+static const kind_t kinds[] = {
+	{"rc", rcLadder, 1e-6, 100, "stages"},
+	{"rlc", rlcLadder, 1e-7, 100, "stages"},
+	{"mesh", mesh, 1e-6, 100, "nodes along each side"},
+	{"lc", lcBank, 1e-6, 100, "tanks"},
+	{"astable", astables, 1e-4, 80, "multivibrators"},
+	{"bridge", bridges, 1e-5, 100, "rectifiers"},
+};
+static const int kinds_count = sizeof(kinds)/sizeof(kinds[0]);
+
+static void usage(void){
+	fprintf(stderr, "usage: netgen kind size [steps]\n");
+	for(int i = 0; i < kinds_count; i++){
+		fprintf(stderr, "  %-8s size is the number of %s\n", kinds[i].name, kinds[i].size);
+	}
+	fprintf(stderr, "steps is the number of time steps, 1000 by default\n");
+}
+
+int main(int argc, char *argv[]){
+	if(argc < 3){ usage(); return -1; }
+	int size = atoi(argv[2]);
+	int steps = (argc > 3)? atoi(argv[3]) : 1000;
+	if(size < 1 || steps < 1){ usage(); return -1; }
+	for(int i = 0; i < kinds_count; i++){
+		if(strcmp(argv[1], kinds[i].name) == 0){
+			printf("# %s %i, written by netgen\n", kinds[i].name, size);
+			header(kinds[i].timestep, steps, kinds[i].convrate);
+			kinds[i].write(size);
+			return 0;
+		}
+	}
+	fprintf(stderr, "error: unrecognised kind \"%s\"\n", argv[1]);
+	usage();
+	return -1;
+}
@@ -0,0 +1,198 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+// reads binary waveform files written by circuitsim --binary, by mapping
+// them in to memory, so only the rows and signals asked for are touched.
+// compile like this:
+// gcc tools/waveread.c -o waveread
+
+#include"../waveform.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+typedef struct {
+	const wave_header_t *h;
+	const char *data;
+	size_t size;
+	uint64_t rows;
+	const char **names, **units;
+} wave_t;
+
+static double value(const wave_t *w, uint64_t row, int signal){
+	uint64_t index;
+	if(w->h->block_rows == 0){
+		index = row*w->h->signal_count + signal;
+	} else {
+		uint64_t block = row/w->h->block_rows, r = row%w->h->block_rows;
+		index = (block*w->h->signal_count + signal)*w->h->block_rows + r;
+	}
+	if(w->h->flags & wave_flag_float){ return ((const float *) w->data)[index]; }
+	return ((const double *) w->data)[index];
+}
+
+static int openWave(const char *path, wave_t *w){
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0){
+		fprintf(stderr, "error: could not open file \"%s\"\n", path);
+		return 0;
+	}
+	w->size = st.st_size;
+	void *map = (w->size > 0)? mmap(NULL, w->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(map == MAP_FAILED || w->size < sizeof(wave_header_t)){
+		fprintf(stderr, "error: could not map file \"%s\"\n", path);
+		return 0;
+	}
+	w->h = map;
+	if(memcmp(w->h->magic, wave_magic, sizeof(w->h->magic)) != 0 || w->h->version != wave_version){
+		fprintf(stderr, "error: \"%s\" is not a circuitsim waveform file\n", path);
+		return 0;
+	}
+	if(w->h->data_offset > w->size){
+		fprintf(stderr, "error: \"%s\" is truncated\n", path);
+		return 0;
+	}
+
+	// signal names and units follow the header
+	w->names = malloc(sizeof(char*)*w->h->signal_count);
+	w->units = malloc(sizeof(char*)*w->h->signal_count);
+	const char *p = (const char *) map + sizeof(wave_header_t);
+	const char *end = (const char *) map + w->h->data_offset;
+	for(uint32_t i = 0; i < w->h->signal_count; i++){
+		w->names[i] = p; p += strnlen(p, end - p) + 1;
+		w->units[i] = p; p += strnlen(p, end - p) + 1;
+		if(p > end){
+			fprintf(stderr, "error: \"%s\" has a corrupt header\n", path);
+			return 0;
+		}
+	}
+	w->data = (const char *) map + w->h->data_offset;
+
+	// an unfinished file has no row count, so use what was written
+	size_t value_size = (w->h->flags & wave_flag_float)? sizeof(float) : sizeof(double);
+	uint64_t available = (w->size - w->h->data_offset)/(value_size*w->h->signal_count);
+	if(w->h->block_rows > 0){ available -= available%w->h->block_rows; }
+	w->rows = w->h->row_count;
+	if(w->rows == 0 || w->rows > available){
+		w->rows = available;
+		// padding rows of a partial block have a time of 0
+		while(w->rows > 1 && value(w, w->rows - 1, 0) == 0){ w->rows--; }
+	}
+	return 1;
+}
+
+// first row with a time of at least t, assuming time only increases
+static uint64_t findTime(const wave_t *w, double t){
+	uint64_t lo = 0, hi = w->rows;
+	while(lo < hi){
+		uint64_t mid = lo + (hi - lo)/2;
+		if(value(w, mid, 0) < t){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+	return lo;
+}
+
+// signals can be named on their own, or with their unit like the csv labels: R1(A)
+static int findSignal(const wave_t *w, const char *s){
+	for(uint32_t i = 0; i < w->h->signal_count; i++){
+		char label[256];
+		snprintf(label, sizeof(label), "%s(%s)", w->names[i], w->units[i]);
+		if(strcmp(s, label) == 0 || strcmp(s, w->names[i]) == 0){ return i; }
+	}
+	return -1;
+}
+
+static void usage(void){
+	fprintf(stderr,
+		"usage: waveread file.bin [options]\n"
+		"  --info            print the signals and size of the file\n"
+		"  --signals a,b,c   only export these signals (time is always included)\n"
+		"  --from t          start at time t\n"
+		"  --to t            stop at time t\n"
+		"  --every n         only export every n'th row\n"
+		"  --precision n     significant digits after the point (default 6)\n"
+		"  --output f.csv    write to a file instead of standard output\n");
+}
+
+int main(int argc, char *argv[]){
+	if(argc < 2){ usage(); return 0; }
+
+	const char *path = NULL, *signals = NULL, *out = NULL;
+	double from = -1e300, to = 1e300;
+	long every = 1;
+	int precision = 6, info = 0;
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--info") == 0){ info = 1; }
+		else if(strcmp(argv[i], "--signals") == 0 && i + 1 < argc){ signals = argv[++i]; }
+		else if(strcmp(argv[i], "--from") == 0 && i + 1 < argc){ from = strtod(argv[++i], NULL); }
+		else if(strcmp(argv[i], "--to") == 0 && i + 1 < argc){ to = strtod(argv[++i], NULL); }
+		else if(strcmp(argv[i], "--every") == 0 && i + 1 < argc){ every = atol(argv[++i]); }
+		else if(strcmp(argv[i], "--precision") == 0 && i + 1 < argc){ precision = atoi(argv[++i]); }
+		else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc){ out = argv[++i]; }
+		else if(path == NULL && argv[i][0] != '-'){ path = argv[i]; }
+		else { usage(); return -1; }
+	}
+	if(path == NULL || every < 1 || precision < 0){ usage(); return -1; }
+
+	wave_t w;
+	if(!openWave(path, &w)){ return -1; }
+
+	if(info){
+		printf("rows: %llu\n", (unsigned long long) w.rows);
+		printf("precision: %s\n", (w.h->flags & wave_flag_float)? "float" : "double");
+		printf("layout: %s", w.h->block_rows? "column blocks of " : "rows\n");
+		if(w.h->block_rows){ printf("%u rows\n", w.h->block_rows); }
+		if(w.rows > 0){
+			printf("time: %.6e to %.6e\n", value(&w, 0, 0), value(&w, w.rows - 1, 0));
+		}
+		for(uint32_t i = 0; i < w.h->signal_count; i++){
+			printf("%s(%s)\n", w.names[i], w.units[i]);
+		}
+		return 0;
+	}
+
+	// pick out the columns to export
+	int *columns = malloc(sizeof(int)*(w.h->signal_count + 1)), count = 0;
+	columns[count++] = 0;
+	if(signals == NULL){
+		for(uint32_t i = 1; i < w.h->signal_count; i++){ columns[count++] = i; }
+	} else {
+		char *list = strdup(signals);
+		for(char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")){
+			int c = findSignal(&w, tok);
+			if(c < 0){
+				fprintf(stderr, "error: unrecognised signal \"%s\"\n", tok);
+				return -1;
+			}
+			if(c > 0 && count <= (int) w.h->signal_count){ columns[count++] = c; }
+		}
+		free(list);
+	}
+
+	FILE *f = (out == NULL)? stdout : fopen(out, "w");
+	if(f == NULL){
+		fprintf(stderr, "error: could not open file \"%s\"\n", out);
+		return -1;
+	}
+	for(int i = 0; i < count; i++){
+		fprintf(f, "%s%s(%s)", (i == 0)? "" : ", ", w.names[columns[i]], w.units[columns[i]]);
+	}
+	fprintf(f, "\n");
+	for(uint64_t row = findTime(&w, from); row < w.rows; row += every){
+		if(value(&w, row, 0) > to){ break; }
+		for(int i = 0; i < count; i++){
+			fprintf(f, "%s%.*e", (i == 0)? "" : ", ", precision, value(&w, row, columns[i]));
+		}
+		fprintf(f, "\n");
+	}
+	if(f != stdout){ fclose(f); }
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Author: Joslyn Renfrey
+ * Date: 13/01/2023
+ */
+
+#ifndef _WAVEFORM_H
+#define _WAVEFORM_H
+
+#include<stdint.h>
+
+/*
+ * binary waveform files are laid out as:
+ *
+ * header     a wave_header_t
+ * signals    signal_count pairs of null terminated strings: name, then unit.
+ *            the first signal is always time, in seconds
+ * padding    zeros up to data_offset, which is a multiple of 8 bytes
+ * data       rows of all the signals, as doubles, or floats if the
+ *            wave_flag_float flag is set. if block_rows is not 0, the rows
+ *            are grouped in to blocks of block_rows rows, and each block is
+ *            stored column by column. the last block is padded to full size
+ *
+ * all values are in the byte order of the machine that wrote the file.
+ * row_count is filled in when the file is closed, if it is still 0 then
+ * the simulation did not finish, and the rows can be counted from the
+ * size of the file
+ */
+
+#define wave_magic "CSIMWAVE"
+#define wave_version 1
+#define wave_flag_float 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version, flags;
+	uint32_t signal_count, block_rows;
+	uint64_t row_count, data_offset;
+} wave_header_t;
+
+#endif